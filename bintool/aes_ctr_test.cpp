@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2025 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Checks that the batched (and for large buffers, threaded) counter mode encryption in aes256_buffer_threaded gives
+// the same output as encrypting the whole buffer in one call, including for lengths which aren't a multiple of the
+// block size
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "bintool.h"
+
+namespace {
+    // a single mbedtls_aes_crypt_ctr call, which adds the block number to the IV
+    void ctr_single_call(const uint8_t *data, size_t len, uint8_t *data_out, const aes_key_t *key, const iv_t *iv) {
+        mbedtls_aes_context aes;
+        mbedtls_aes_init(&aes);
+        mbedtls_aes_setkey_enc(&aes, key->bytes, 256);
+        uint8_t nonce_counter[16];
+        uint8_t stream_block[16] = {0};
+        size_t nc_off = 0;
+        memcpy(nonce_counter, iv->bytes, sizeof(nonce_counter));
+        mbedtls_aes_crypt_ctr(&aes, len, &nc_off, nonce_counter, stream_block, data, data_out);
+        mbedtls_aes_free(&aes);
+    }
+
+#if IV0_XOR
+    // one block at a time, with the block number XORed into the IV
+    void ctr_xor_blockwise(const uint8_t *data, size_t len, uint8_t *data_out, const aes_key_t *key, const iv_t *iv) {
+        mbedtls_aes_context aes;
+        mbedtls_aes_init(&aes);
+        mbedtls_aes_setkey_enc(&aes, key->bytes, 256);
+        for (size_t i = 0; i < len; i += 16) {
+            uint8_t nonce_xor[16];
+            uint8_t stream[16];
+            memcpy(nonce_xor, iv->bytes, sizeof(nonce_xor));
+            uint32_t counter = (uint32_t)(i / 16);
+            for (int j = 0; j < 4; j++) nonce_xor[15 - j] ^= (uint8_t)(counter >> (j * 8));
+            mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_ENCRYPT, nonce_xor, stream);
+            for (size_t j = i; j < std::min(len, i + 16); j++) data_out[j] = data[j] ^ stream[j - i];
+        }
+        mbedtls_aes_free(&aes);
+    }
+#endif
+
+    int failures = 0;
+
+    void check(const char *what, const std::vector<uint8_t> &got, const std::vector<uint8_t> &expected) {
+        if (got != expected) {
+            size_t i = 0;
+            while (got[i] == expected[i]) i++;
+            printf("FAIL: %s, length %zu: first difference at %zu\n", what, got.size(), i);
+            failures++;
+        }
+    }
+}
+
+int main() {
+    std::mt19937 rng(1);
+    aes_key_t key;
+    for (auto &b : key.bytes) b = rng();
+    // with the low 32 bits of the IV clear, adding and XORing the block number are the same
+    iv_t iv;
+    for (auto &b : iv.bytes) b = rng();
+    memset(iv.bytes + 12, 0, 4);
+
+    // short lengths either side of the 64 block batches, then lengths large enough to be split across threads
+    std::vector<size_t> lengths;
+    for (size_t len = 0; len <= 70 * 16; len += 7) lengths.push_back(len);
+    for (size_t len : {(size_t)64 * 16 - 1, (size_t)64 * 16 + 1, (size_t)(1u << 20) + 5, (size_t)(4u << 20) + 15,
+                       (size_t)(8u << 20) - 3}) {
+        lengths.push_back(len);
+    }
+
+    std::vector<uint8_t> data(*std::max_element(lengths.begin(), lengths.end()));
+    for (auto &b : data) b = rng();
+    for (size_t len : lengths) {
+        std::vector<uint8_t> got(len), expected(len);
+        aes256_buffer_threaded(data.data(), len, got.data(), &key, &iv);
+        ctr_single_call(data.data(), len, expected.data(), &key, &iv);
+        check("aes256_buffer_threaded vs mbedtls_aes_crypt_ctr", got, expected);
+#if IV0_XOR
+        // with any IV, the result must match XORing the block number in one block at a time
+        iv_t any_iv;
+        for (auto &b : any_iv.bytes) b = rng();
+        aes256_buffer_threaded(data.data(), len, got.data(), &key, &any_iv);
+        ctr_xor_blockwise(data.data(), len, expected.data(), &key, &any_iv);
+        check("aes256_buffer_threaded vs blockwise IV0 XOR", got, expected);
+#endif
+    }
+
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("AES counter mode tests passed\n");
+    return 0;
+}
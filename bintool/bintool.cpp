@@ -6,11 +6,13 @@
 #include <random>
 #include <cinttypes>
 #include <tuple>
+#include <thread>
 
 #include "boot/picobin.h"
 #include <map>
 
 #include "elf_file.h"
+#include "crc32.h"
 
 #if HAS_MBEDTLS
     #include "mbedtls_wrapper.h"
@@ -501,123 +503,47 @@ block place_new_block(std::vector<uint8_t> &bin, uint32_t storage_addr, std::uni
 
 
 // Checksum stuff
-uint32_t poly8_lookup[256] =
-{
- 0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA,
- 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
- 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
- 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
- 0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE,
- 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
- 0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC,
- 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
- 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
- 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
- 0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940,
- 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
- 0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116,
- 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
- 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
- 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
- 0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A,
- 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
- 0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818,
- 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
- 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
- 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
- 0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C,
- 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
- 0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2,
- 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
- 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
- 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
- 0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086,
- 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
- 0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4,
- 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
- 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
- 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
- 0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8,
- 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
- 0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE,
- 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
- 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
- 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
- 0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252,
- 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
- 0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60,
- 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
- 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
- 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
- 0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04,
- 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
- 0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A,
- 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
- 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
- 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
- 0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E,
- 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
- 0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C,
- 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
- 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
- 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
- 0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0,
- 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
- 0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6,
- 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
- 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
- 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-};
-
-uint32_t crc32_byte(const uint8_t *p, uint32_t bytelength)
-{
-	uint32_t crc = 0xffffffff;
-	while (bytelength-- !=0) crc = poly8_lookup[((uint8_t) crc ^ *(p++))] ^ (crc >> 8);
-	return crc;
-}
+uint32_t calc_checksum(const std::vector<uint8_t> &bin) {
+    assert(bin.size() == 252);
 
-uint8_t rev_8(uint8_t b) {
-    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
-    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
-    b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
-    return b;
+    return crc32_sw(bin.data(), bin.size(), 0xffffffff);
 }
 
-uint32_t rev_32(uint32_t b) {
-    uint8_t b0 = rev_8(b >> 24);
-    uint8_t b1 = rev_8(b >> 16);
-    uint8_t b2 = rev_8(b >> 8);
-    uint8_t b3 = rev_8(b);
-    return (b3 << 24) | (b2 << 16) | (b1 << 8) | b0;
-}
 
-void crc32(const uint8_t *data, size_t len, uint32_t* cs_out) {
-    uint8_t rev_data[252] = {};
-    for (size_t i=0; i < sizeof(rev_data); i++) {
-        rev_data[i] = rev_8(data[i]);
+#if HAS_MBEDTLS
+// Large buffers are encrypted by up to this many threads, each with at least AES_MIN_BLOCKS_PER_THREAD blocks
+#define AES_MAX_THREADS 8u
+#define AES_MIN_BLOCKS_PER_THREAD 16384u
+
+// The counter mode stream for each block only depends on its block number, so the buffer is split into
+// contiguous runs of blocks which are encrypted independently; only the last block may be partial
+void aes256_buffer_threaded(const uint8_t *data, size_t len, uint8_t *data_out, const aes_key_t *key, iv_t *iv) {
+    size_t num_blocks = (len + 15) / 16;
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::min(num_threads, (size_t)AES_MAX_THREADS);
+    num_threads = std::max((size_t)1, std::min(num_threads, num_blocks / AES_MIN_BLOCKS_PER_THREAD));
+    size_t per_thread = (num_blocks + num_threads - 1) / num_threads;
+    auto encrypt_blocks = [&](size_t from, size_t to) {
+        if (from >= to) return;
+        mb_aes256_ctr_blocks(data + from * 16, std::min(len, to * 16) - from * 16, data_out + from * 16, key, iv, (uint32_t)from);
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; t++) {
+        threads.emplace_back(encrypt_blocks, std::min(num_blocks, t * per_thread), std::min(num_blocks, (t + 1) * per_thread));
+    }
+    encrypt_blocks(0, std::min(num_blocks, per_thread));
+    for (auto &thread : threads) {
+        thread.join();
     }
-
-    uint32_t crc = crc32_byte(rev_data, sizeof(rev_data));
-
-    crc = rev_32(crc);
-
-    *cs_out = crc;
-}
-
-uint32_t calc_checksum(std::vector<uint8_t> bin) {
-    assert(bin.size() == 252);
-
-    uint32_t checksum = 0;
-    crc32(bin.data(), bin.size(), &checksum);
-
-    return checksum;
 }
 
-
-#if HAS_MBEDTLS
-void hash_andor_sign_block(block *new_block, const public_t public_key, const private_t private_key, bool hash_value, bool sign, std::vector<uint8_t> to_hash) {
+// Add a hash and/or signature to the block, covering whatever has been passed to to_hash followed by the block itself;
+// this finishes to_hash
+static void hash_andor_sign_block(block *new_block, const public_t public_key, const private_t private_key, bool hash_value, bool sign, sha256_state_t *to_hash) {
+    message_digest_t sha256;
     if (!(hash_value || sign)) {
         // Don't need to add anything if not actually hashing or signing
+        sha256_finish(to_hash, &sha256);
         return;
     }
 
@@ -636,10 +562,8 @@ void hash_andor_sign_block(block *new_block, const public_t public_key, const pr
         }
     }
     auto block_hashed_contents = words_to_lsb_bytes(tmp_words.begin(), tmp_words.end() - 3); // remove stuff at end
-    std::copy(block_hashed_contents.begin(), block_hashed_contents.end(), std::back_inserter(to_hash));
-
-    message_digest_t sha256;
-    sha256_buffer(to_hash.data(), to_hash.size(), &sha256);
+    sha256_update(to_hash, block_hashed_contents.data(), block_hashed_contents.size());
+    sha256_finish(to_hash, &sha256);
     dumper("SHA256", sha256);
 
     if (sign) {
@@ -675,6 +599,13 @@ void hash_andor_sign_block(block *new_block, const public_t public_key, const pr
     }
 }
 
+void hash_andor_sign_block(block *new_block, const public_t public_key, const private_t private_key, bool hash_value, bool sign, const std::vector<uint8_t> &to_hash) {
+    sha256_state_t state;
+    sha256_start(&state);
+    sha256_update(&state, to_hash.data(), to_hash.size());
+    hash_andor_sign_block(new_block, public_key, private_key, hash_value, sign, &state);
+}
+
 
 bool detect_generic_load_map_entry(const load_map_item::entry& entry, model_t model, bool &pin_xip_sram) {
     if (!pin_xip_sram) { // don't change if already set
@@ -722,8 +653,20 @@ void remove_non_generic_load_map_entries(block *new_block, model_t model) {
 }
 
 
-std::vector<uint8_t> get_lm_hash_data(elf_file *elf, block *new_block, model_t model, bool clear_sram = false, bool pin_xip_sram = false) {
-    std::vector<uint8_t> to_hash;
+// Called with the data covered by a load map, in load map order, a piece at a time
+typedef std::function<void(const uint8_t *data, size_t size)> lm_data_cb;
+
+// BIN data that isn't already in memory is fetched with get_more_bin_cb this much at a time
+#define LM_DATA_READ_SIZE 0x100000u
+
+// A load map entry with no storage address (eg clearing SRAM) is hashed as its size
+static void lm_data_size(const lm_data_cb &data_cb, uint32_t size) {
+    std::vector<uint32_t> size_vec = {size};
+    auto size_data = words_to_lsb_bytes(size_vec.begin(), size_vec.end());
+    data_cb(size_data.data(), size_data.size());
+}
+
+static void get_lm_hash_data(elf_file *elf, block *new_block, model_t model, const lm_data_cb &data_cb, bool clear_sram = false, bool pin_xip_sram = false) {
     std::shared_ptr<load_map_item> load_map = new_block->get_item<load_map_item>();
     if (detect_generic_load_map(load_map, model, pin_xip_sram)) {
         new_block->items.erase(std::remove(new_block->items.begin(), new_block->items.end(), load_map), new_block->items.end());
@@ -732,38 +675,30 @@ std::vector<uint8_t> get_lm_hash_data(elf_file *elf, block *new_block, model_t m
     if (load_map == nullptr) {
         std::vector<load_map_item::entry> entries;
         if (clear_sram) {
-            // todo tidy up this way of hashing the uint32_t
-            std::vector<uint32_t> sram_size_vec = {model->sram_end() - model->sram_start()};
+            uint32_t sram_size = model->sram_end() - model->sram_start();
             entries.push_back({
                 0x0,
                 model->sram_start(),
-                sram_size_vec[0]
+                sram_size
             });
-            auto sram_size_data = words_to_lsb_bytes(sram_size_vec.begin(), sram_size_vec.end());
-            std::copy(sram_size_data.begin(), sram_size_data.end(), std::back_inserter(to_hash));
-            DEBUG_LOG("CLEAR %08x + %08x\n", (int)model->sram_start(), (int)sram_size_vec[0]);
+            lm_data_size(data_cb, sram_size);
+            DEBUG_LOG("CLEAR %08x + %08x\n", (int)model->sram_start(), (int)sram_size);
         }
         if (pin_xip_sram) {
-            // todo tidy up this way of hashing the uint32_t
-            std::vector<uint32_t> xip_pin_size_vec = {0x0};
+            uint32_t xip_pin_size = 0x0;
             entries.push_back({
                 0x0,
                 model->xip_sram_start(),
-                xip_pin_size_vec[0]
+                xip_pin_size
             });
-            auto xip_pin_size_data = words_to_lsb_bytes(xip_pin_size_vec.begin(), xip_pin_size_vec.end());
-            std::copy(xip_pin_size_data.begin(), xip_pin_size_data.end(), std::back_inserter(to_hash));
-            DEBUG_LOG("PIN XIP SRAM %08x + %08x\n", (int)model->xip_sram_start(), (int)xip_pin_size_vec[0]);
+            lm_data_size(data_cb, xip_pin_size);
+            DEBUG_LOG("PIN XIP SRAM %08x + %08x\n", (int)model->xip_sram_start(), (int)xip_pin_size);
         }
         for(const auto &seg : elf->sorted_segments()) {
             if (!seg->is_load()) continue;
-            const auto data = elf->content(*seg);
             // std::cout << "virt = " << std::hex << seg->virtual_address() << " + " << std::hex << seg->virtual_size() << ", phys = " << std::hex << seg->physical_address() << " + " << std::hex << seg->physical_size() << std::endl;
-            if (data.size() != seg->physical_size()) {
-                fail(ERROR_INCOMPATIBLE, "Elf segment physical size (%" PRIx32 ") does not match data size in file (%zx)", seg->physical_size(), data.size());
-            }
             if (seg->physical_size()) {
-                std::copy(data.begin(), data.end(), std::back_inserter(to_hash));
+                data_cb(elf->content_data(*seg), seg->physical_size());
                 DEBUG_LOG("HASH %08x + %08x\n", (int)seg->physical_address(), (int)seg->physical_size());
                 entries.push_back(
                     {
@@ -780,40 +715,32 @@ std::vector<uint8_t> get_lm_hash_data(elf_file *elf, block *new_block, model_t m
         DEBUG_LOG("Already has load map, so hashing that\n");
         // todo hash existing load map
         for(const auto &entry : load_map->entries) {
-            std::vector<uint8_t> data;
-            uint32_t current_storage_address = entry.storage_address;
-            if (current_storage_address == 0) {
-                std::copy(
-                    (uint8_t*)&entry.size,
-                    (uint8_t*)&entry.size + sizeof(entry.size),
-                    std::back_inserter(to_hash));
+            if (entry.storage_address == 0) {
+                lm_data_size(data_cb, entry.size);
                 DEBUG_LOG("CLEAR %08x + %08x\n", (int)entry.runtime_address, (int)entry.size);
             } else {
-                while (data.size() < entry.size) {
+                // the entry may span several segments
+                uint32_t current_storage_address = entry.storage_address;
+                uint32_t remaining = entry.size;
+                while (remaining) {
                     auto seg = elf->segment_from_physical_address(current_storage_address);
                     if (seg == nullptr) {
                         fail(ERROR_NOT_POSSIBLE, "The ELF file does not contain the storage address %x", current_storage_address);
                     }
-                    const auto new_data = elf->content(*seg);
-
                     uint32_t offset = current_storage_address - seg->physical_address();
-
-                    std::copy(new_data.begin()+offset, new_data.end(), std::back_inserter(data));
-                    current_storage_address += new_data.size();
+                    uint32_t size = std::min(remaining, seg->physical_size() - offset);
+                    data_cb(elf->content_data(*seg) + offset, size);
+                    current_storage_address += size;
+                    remaining -= size;
                 }
-                data.resize(entry.size);
-                std::copy(data.begin(), data.end(), std::back_inserter(to_hash));
-                DEBUG_LOG("HASH %08x + %08x\n", (int)entry.storage_address, (int)data.size());
+                DEBUG_LOG("HASH %08x + %08x\n", (int)entry.storage_address, (int)entry.size);
             }
         }
     }
-
-    return to_hash;
 }
 
 
-std::vector<uint8_t> get_lm_hash_data(std::vector<uint8_t> bin, uint32_t storage_addr, uint32_t runtime_addr, block *new_block, get_more_bin_cb more_cb, model_t model, bool clear_sram = false, bool pin_xip_sram = false) {
-    std::vector<uint8_t> to_hash;
+static void get_lm_hash_data(std::vector<uint8_t> &bin, uint32_t storage_addr, uint32_t runtime_addr, block *new_block, get_more_bin_cb more_cb, model_t model, const lm_data_cb &data_cb, bool clear_sram = false, bool pin_xip_sram = false) {
     std::shared_ptr<load_map_item> load_map = new_block->get_item<load_map_item>();
     if (detect_generic_load_map(load_map, model, pin_xip_sram)) {
         new_block->items.erase(std::remove(new_block->items.begin(), new_block->items.end(), load_map), new_block->items.end());
@@ -822,31 +749,27 @@ std::vector<uint8_t> get_lm_hash_data(std::vector<uint8_t> bin, uint32_t storage
     if (load_map == nullptr) {
         std::vector<load_map_item::entry> entries;
         if (clear_sram) {
-            // todo tidy up this way of hashing the uint32_t
-            std::vector<uint32_t> sram_size_vec = {model->sram_end() - model->sram_start()};
-            assert(sram_size_vec[0] % 4 == 0);
+            uint32_t sram_size = model->sram_end() - model->sram_start();
+            assert(sram_size % 4 == 0);
             entries.push_back({
                 0x0,
                 model->sram_start(),
-                sram_size_vec[0]
+                sram_size
             });
-            auto sram_size_data = words_to_lsb_bytes(sram_size_vec.begin(), sram_size_vec.end());
-            std::copy(sram_size_data.begin(), sram_size_data.end(), std::back_inserter(to_hash));
-            DEBUG_LOG("CLEAR %08x + %08x\n", (int)model->sram_start(), (int)sram_size_vec[0]);
+            lm_data_size(data_cb, sram_size);
+            DEBUG_LOG("CLEAR %08x + %08x\n", (int)model->sram_start(), (int)sram_size);
         }
         if (pin_xip_sram) {
-            // todo tidy up this way of hashing the uint32_t
-            std::vector<uint32_t> xip_pin_size_vec = {0x0};
+            uint32_t xip_pin_size = 0x0;
             entries.push_back({
                 0x0,
                 model->xip_sram_start(),
-                xip_pin_size_vec[0]
+                xip_pin_size
             });
-            auto xip_pin_size_data = words_to_lsb_bytes(xip_pin_size_vec.begin(), xip_pin_size_vec.end());
-            std::copy(xip_pin_size_data.begin(), xip_pin_size_data.end(), std::back_inserter(to_hash));
-            DEBUG_LOG("PIN XIP SRAM %08x + %08x\n", (int)model->xip_sram_start(), (int)xip_pin_size_vec[0]);
+            lm_data_size(data_cb, xip_pin_size);
+            DEBUG_LOG("PIN XIP SRAM %08x + %08x\n", (int)model->xip_sram_start(), (int)xip_pin_size);
         }
-        to_hash.insert(to_hash.begin(), bin.begin(), bin.end());
+        data_cb(bin.data(), bin.size());
         DEBUG_LOG("HASH %08x + %08x\n", (int)storage_addr, (int)bin.size());
         entries.push_back(
             {
@@ -863,38 +786,45 @@ std::vector<uint8_t> get_lm_hash_data(std::vector<uint8_t> bin, uint32_t storage
         uint32_t current_bin_start = storage_addr;
         for(const auto &entry : load_map->entries) {
             if (entry.storage_address == 0) {
-                std::copy(
-                    (uint8_t*)&entry.size,
-                    (uint8_t*)&entry.size + sizeof(entry.size),
-                    std::back_inserter(to_hash));
+                lm_data_size(data_cb, entry.size);
                 DEBUG_LOG("CLEAR %08x + %08x\n", (int)entry.runtime_address, (int)entry.size);
             } else {
-                if (entry.storage_address + entry.size > current_bin_start + bin.size()) {
-                    if (more_cb == nullptr) {
-                        fail(ERROR_NOT_POSSIBLE, "BIN does not contain data for load_map entry %08x->%08x", entry.storage_address, entry.storage_address + entry.size);
+                uint32_t current_storage_address = entry.storage_address;
+                uint32_t remaining = entry.size;
+                while (remaining) {
+                    if (current_storage_address < current_bin_start || current_storage_address - current_bin_start >= bin.size()) {
+                        if (more_cb == nullptr) {
+                            fail(ERROR_NOT_POSSIBLE, "BIN does not contain data for load_map entry %08x->%08x", entry.storage_address, entry.storage_address + entry.size);
+                        }
+                        uint32_t read_size = std::min(remaining, (uint32_t)LM_DATA_READ_SIZE);
+                        DEBUG_LOG("Reading into bin %08x+%x\n", current_storage_address, read_size);
+                        more_cb(bin, current_storage_address, read_size);
+                        current_bin_start = current_storage_address;
+                        if (bin.empty()) {
+                            fail(ERROR_NOT_POSSIBLE, "BIN does not contain data for load_map entry %08x->%08x", entry.storage_address, entry.storage_address + entry.size);
+                        }
                     }
-                    DEBUG_LOG("Reading into bin %08x+%x\n", entry.storage_address, entry.size);
-                    more_cb(bin, entry.storage_address, entry.size);
-                    current_bin_start = entry.storage_address;
+                    uint32_t rel_addr = current_storage_address - current_bin_start;
+                    uint32_t size = std::min(remaining, (uint32_t)bin.size() - rel_addr);
+                    data_cb(bin.data() + rel_addr, size);
+                    current_storage_address += size;
+                    remaining -= size;
                 }
-                uint32_t rel_addr = entry.storage_address - current_bin_start;
-                std::copy(
-                    bin.begin() + rel_addr,
-                    bin.begin() + rel_addr + entry.size,
-                    std::back_inserter(to_hash));
                 DEBUG_LOG("HASH %08x + %08x\n", (int)entry.storage_address, (int)entry.size);
             }
         }
     }
-
-    return to_hash;
 }
 
 
 int hash_andor_sign(elf_file *elf, block *new_block, const public_t public_key, const private_t private_key, model_t model, bool hash_value, bool sign, bool clear_sram, bool pin_xip_sram) {
-    std::vector<uint8_t> to_hash = get_lm_hash_data(elf, new_block, model, clear_sram, pin_xip_sram);
+    sha256_state_t to_hash;
+    sha256_start(&to_hash);
+    get_lm_hash_data(elf, new_block, model, [&to_hash](const uint8_t *data, size_t size) {
+        sha256_update(&to_hash, data, size);
+    }, clear_sram, pin_xip_sram);
 
-    hash_andor_sign_block(new_block, public_key, private_key, hash_value, sign, to_hash);
+    hash_andor_sign_block(new_block, public_key, private_key, hash_value, sign, &to_hash);
     
     auto tmp = new_block->to_words();
     std::vector<uint8_t> data = words_to_lsb_bytes(tmp.begin(), tmp.end());
@@ -927,9 +857,13 @@ int hash_andor_sign(elf_file *elf, block *new_block, const public_t public_key,
 
 
 std::vector<uint8_t> hash_andor_sign(std::vector<uint8_t> bin, uint32_t storage_addr, uint32_t runtime_addr, block *new_block, const public_t public_key, const private_t private_key, model_t model, bool hash_value, bool sign, bool clear_sram, bool pin_xip_sram) {
-    std::vector<uint8_t> to_hash = get_lm_hash_data(bin, storage_addr, runtime_addr, new_block, nullptr, model, clear_sram, pin_xip_sram);
+    sha256_state_t to_hash;
+    sha256_start(&to_hash);
+    get_lm_hash_data(bin, storage_addr, runtime_addr, new_block, nullptr, model, [&to_hash](const uint8_t *data, size_t size) {
+        sha256_update(&to_hash, data, size);
+    }, clear_sram, pin_xip_sram);
 
-    hash_andor_sign_block(new_block, public_key, private_key, hash_value, sign, to_hash);
+    hash_andor_sign_block(new_block, public_key, private_key, hash_value, sign, &to_hash);
 
     auto tmp = new_block->to_words();
     std::vector<uint8_t> data = words_to_lsb_bytes(tmp.begin(), tmp.end());
@@ -947,7 +881,11 @@ void verify_block(std::vector<uint8_t> bin, uint32_t storage_addr, uint32_t runt
     if (hash_def == nullptr) {
         return;
     }
-    std::vector<uint8_t> to_hash = get_lm_hash_data(bin, storage_addr, runtime_addr, block, more_cb, model);
+    sha256_state_t to_hash;
+    sha256_start(&to_hash);
+    get_lm_hash_data(bin, storage_addr, runtime_addr, block, more_cb, model, [&to_hash](const uint8_t *data, size_t size) {
+        sha256_update(&to_hash, data, size);
+    });
 
     // auto it = std::find(block->items.begin(), block->items.end(), hash_def);
     // assert (it != block->items.end());
@@ -965,11 +903,11 @@ void verify_block(std::vector<uint8_t> bin, uint32_t storage_addr, uint32_t runt
         }
     }
     auto block_hashed_contents = words_to_lsb_bytes(tmp_words.begin(), tmp_words.end());
-    std::copy(block_hashed_contents.begin(), block_hashed_contents.end(), std::back_inserter(to_hash));
+    sha256_update(&to_hash, block_hashed_contents.data(), block_hashed_contents.size());
 
     message_digest_t sha256;
     message_digest_t block_sha256;
-    sha256_buffer(to_hash.data(), to_hash.size(), &sha256);
+    sha256_finish(&to_hash, &sha256);
     dumper("SHA256", sha256);
 
     std::shared_ptr<hash_value_item> hash_value = block->get_item<hash_value_item>();
@@ -1009,7 +947,10 @@ void verify_block(std::vector<uint8_t> bin, uint32_t storage_addr, uint32_t runt
 
 
 void encrypt_guts(elf_file *elf, block *new_block, const aes_key_t aes_key, model_t model, std::vector<uint8_t> &iv_data, std::vector<uint8_t> &enc_data) {
-    std::vector<uint8_t> to_enc = get_lm_hash_data(elf, new_block, model);
+    std::vector<uint8_t> to_enc;
+    get_lm_hash_data(elf, new_block, model, [&to_enc](const uint8_t *data, size_t size) {
+        to_enc.insert(to_enc.end(), data, data + size);
+    });
 
     std::random_device rand{};
     assert(rand.max() - rand.min() >= 256);
@@ -1029,7 +970,7 @@ void encrypt_guts(elf_file *elf, block *new_block, const aes_key_t aes_key, mode
 
     enc_data.resize(to_enc.size());
 
-    aes256_buffer(to_enc.data(), to_enc.size(), enc_data.data(), &aes_key, &iv);
+    aes256_buffer_threaded(to_enc.data(), to_enc.size(), enc_data.data(), &aes_key, &iv);
 }
 
 
@@ -1152,7 +1093,7 @@ std::vector<uint8_t> encrypt(std::vector<uint8_t> bin, uint32_t storage_addr, ui
     std::vector<uint8_t> enc_data;
     enc_data.resize(bin.size());
 
-    aes256_buffer(bin.data(), bin.size(), enc_data.data(), &aes_key, &iv);
+    aes256_buffer_threaded(bin.data(), bin.size(), enc_data.data(), &aes_key, &iv);
     std::copy(enc_data.begin(), enc_data.end(), bin.begin());
 
     block link_block(0x20000000, enc_data.size());
@@ -18,9 +18,12 @@ typedef enum verified_t {
 // Common
 #if HAS_MBEDTLS
     int read_keys(const std::string &filename, public_t *public_key, private_t *private_key);
-    void hash_andor_sign_block(block *new_block, const public_t public_key, const private_t private_key, bool hash_value, bool sign, std::vector<uint8_t> to_hash = {});
+    void hash_andor_sign_block(block *new_block, const public_t public_key, const private_t private_key, bool hash_value, bool sign, const std::vector<uint8_t> &to_hash = {});
     bool detect_generic_load_map(std::shared_ptr<load_map_item> load_map, model_t model, bool &pin_xip_sram);
     void remove_non_generic_load_map_entries(block *new_block, model_t model);
+    // AES-256 counter mode encrypt/decrypt of len bytes (which needn't be a multiple of the block size), using
+    // several threads for large buffers
+    void aes256_buffer_threaded(const uint8_t *data, size_t len, uint8_t *data_out, const aes_key_t *key, iv_t *iv);
 #endif
 
 // Elfs
@@ -38,7 +41,7 @@ std::unique_ptr<block> find_first_block(std::vector<uint8_t> bin, uint32_t stora
 std::unique_ptr<block> get_last_block(std::vector<uint8_t> &bin, uint32_t storage_addr, std::unique_ptr<block> &first_block, get_more_bin_cb more_cb = nullptr);
 std::vector<std::unique_ptr<block>> get_all_blocks(std::vector<uint8_t> &bin, uint32_t storage_addr, std::unique_ptr<block> &first_block, get_more_bin_cb more_cb = nullptr);
 block place_new_block(std::vector<uint8_t> &bin, uint32_t storage_addr, std::unique_ptr<block> &first_block, model_t model, bool set_others_ignored=false);
-uint32_t calc_checksum(std::vector<uint8_t> bin);
+uint32_t calc_checksum(const std::vector<uint8_t> &bin);
 #if HAS_MBEDTLS
     std::vector<uint8_t> hash_andor_sign(std::vector<uint8_t> bin, uint32_t storage_addr, uint32_t runtime_addr, block *new_block, const public_t public_key, const private_t private_key, model_t model, bool hash_value, bool sign, bool clear_sram = false, bool pin_xip_sram = false);
     std::vector<uint8_t> encrypt(std::vector<uint8_t> bin, uint32_t storage_addr, uint32_t runtime_addr, block *new_block, const aes_key_t aes_key, const public_t public_key, const private_t private_key, model_t model, std::vector<uint8_t> iv_salt, bool hash_value, bool sign);
@@ -40,62 +40,109 @@ void mb_sha256_buffer(const uint8_t *data, size_t len, message_digest_t *digest_
     mbedtls_sha256(data, len, digest_out->bytes, 0);
 }
 
+void mb_sha256_start(sha256_state_t *state) {
+    mbedtls_sha256_init(&state->ctx);
+#if MBEDTLS_VERSION_MAJOR >= 3
+    mbedtls_sha256_starts(&state->ctx, 0);
+#else
+    mbedtls_sha256_starts_ret(&state->ctx, 0);
+#endif
+}
+
+void mb_sha256_update(sha256_state_t *state, const uint8_t *data, size_t len) {
+#if MBEDTLS_VERSION_MAJOR >= 3
+    mbedtls_sha256_update(&state->ctx, data, len);
+#else
+    mbedtls_sha256_update_ret(&state->ctx, data, len);
+#endif
+}
+
+void mb_sha256_finish(sha256_state_t *state, message_digest_t *digest_out) {
+#if MBEDTLS_VERSION_MAJOR >= 3
+    mbedtls_sha256_finish(&state->ctx, digest_out->bytes);
+#else
+    mbedtls_sha256_finish_ret(&state->ctx, digest_out->bytes);
+#endif
+    mbedtls_sha256_free(&state->ctx);
+}
+
+// counter blocks are encrypted this many at a time, so the XOR with the data can run over a whole batch
+#define MB_AES_CTR_BATCH_BLOCKS 64
+
 #if IV0_XOR
-// Taken from mbedtls_aes_crypt_ctr, but with XOR instead of adding to IV0
-int mb_aes_crypt_ctr_xor(mbedtls_aes_context *ctx,
+// Taken from mbedtls_aes_crypt_ctr, but with XOR instead of adding to IV0, and starting at block number counter
+static int mb_aes_crypt_ctr_xor(mbedtls_aes_context *ctx,
     size_t length,
-    unsigned char iv0[16],
-    unsigned char nonce_xor[16],
-    unsigned char stream_block[16],
+    const unsigned char iv0[16],
+    uint32_t counter,
     const unsigned char *input,
     unsigned char *output)
 {
-    int c;
+    unsigned char nonce_xor[16];
+    unsigned char stream[MB_AES_CTR_BATCH_BLOCKS * 16];
     int ret = 0;
-    size_t n = 0;
-    uint32_t counter = 0;
-
-    assert(length == (uint32_t)length);
-
-    while (length--) {
-        if (n == 0) {
-            for (int i = 16; i > 0; i--) {
-                nonce_xor[i-1] = iv0[i-1];
-                if (i > 16 - sizeof(counter)) {
-                    nonce_xor[i-1] ^= (unsigned char)(counter >> ((16-i)*8));
-                }
-            }
 
-            ret = mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_ENCRYPT, nonce_xor, stream_block);
+    assert((length + 15) / 16 <= (uint64_t)UINT32_MAX + 1 - counter);
+
+    while (length) {
+        size_t n = length < sizeof(stream) ? length : sizeof(stream);
+        for (size_t b = 0; b < (n + 15) / 16; b++) {
+            memcpy(nonce_xor, iv0, 16);
+            for (int i = 0; i < 4; i++) {
+                nonce_xor[15 - i] ^= (unsigned char)(counter >> (i * 8));
+            }
+            // the ECB call uses AES-NI (or the Armv8 crypto extensions) when mbedtls finds them at runtime
+            ret = mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_ENCRYPT, nonce_xor, stream + b * 16);
             if (ret != 0) {
-                break;
+                return ret;
             }
             counter++;
         }
-        c = *input++;
-        *output++ = (unsigned char) (c ^ stream_block[n]);
-
-        n = (n + 1) & 0x0F;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint64_t d, k;
+            memcpy(&d, input + i, 8);
+            memcpy(&k, stream + i, 8);
+            d ^= k;
+            memcpy(output + i, &d, 8);
+        }
+        for (; i < n; i++) {
+            output[i] = (unsigned char)(input[i] ^ stream[i]);
+        }
+        input += n;
+        output += n;
+        length -= n;
     }
 
     return ret;
 }
 #endif
 
-void mb_aes256_buffer(const uint8_t *data, size_t len, uint8_t *data_out, const aes_key_t *key, iv_t *iv) {
+void mb_aes256_ctr_blocks(const uint8_t *data, size_t len, uint8_t *data_out, const aes_key_t *key, const iv_t *iv, uint32_t first_block) {
     mbedtls_aes_context aes;
 
-    assert(len % 16 == 0);
-
+    mbedtls_aes_init(&aes);
     mbedtls_aes_setkey_enc(&aes, key->bytes, 256);
-    uint8_t stream_block[16] = {0};
-    size_t nc_off = 0;
 #if IV0_XOR
-    uint8_t xor_working_block[16] = {0};
-    mb_aes_crypt_ctr_xor(&aes, len, iv->bytes, xor_working_block, stream_block, data, data_out);
+    mb_aes_crypt_ctr_xor(&aes, len, iv->bytes, first_block, data, data_out);
 #else
-    mbedtls_aes_crypt_ctr(&aes, len, &nc_off, iv->bytes, stream_block, data, data_out);
+    uint8_t stream_block[16] = {0};
+    uint8_t nonce_counter[16];
+    size_t nc_off = 0;
+    // nonce_counter = IV0 + first_block, as a 128 bit big endian number
+    uint32_t carry = first_block;
+    for (int i = 15; i >= 0; i--) {
+        carry += iv->bytes[i];
+        nonce_counter[i] = (uint8_t)carry;
+        carry >>= 8;
+    }
+    mbedtls_aes_crypt_ctr(&aes, len, &nc_off, nonce_counter, stream_block, data, data_out);
 #endif
+    mbedtls_aes_free(&aes);
+}
+
+void mb_aes256_buffer(const uint8_t *data, size_t len, uint8_t *data_out, const aes_key_t *key, iv_t *iv) {
+    mb_aes256_ctr_blocks(data, len, data_out, key, iv, 0);
 }
 
 void raw_to_der(signature_t *sig) {
@@ -69,8 +69,19 @@ typedef struct aes_key_share {
 typedef signature_t public_t;
 typedef message_digest_t private_t;
 
+typedef struct sha256_state {
+    mbedtls_sha256_context ctx;
+} sha256_state_t; /**< Convenience typedef */
+
 void mb_sha256_buffer(const uint8_t *data, size_t len, message_digest_t *digest_out);
+// incremental version of mb_sha256_buffer, for data that arrives in pieces; mb_sha256_finish frees the state
+void mb_sha256_start(sha256_state_t *state);
+void mb_sha256_update(sha256_state_t *state, const uint8_t *data, size_t len);
+void mb_sha256_finish(sha256_state_t *state, message_digest_t *digest_out);
 void mb_aes256_buffer(const uint8_t *data, size_t len, uint8_t *data_out, const aes_key_t *key, iv_t *iv);
+// encrypt/decrypt len bytes that start first_block blocks into the counter mode stream, so a buffer can be split up
+// at block boundaries (len needn't be a multiple of the block size, so the last part can be a partial block)
+void mb_aes256_ctr_blocks(const uint8_t *data, size_t len, uint8_t *data_out, const aes_key_t *key, const iv_t *iv, uint32_t first_block);
 void mb_sign_sha256(const uint8_t *entropy, size_t entropy_size, const message_digest_t *m, const public_t *p, const private_t *d, signature_t *out);
 
 uint32_t mb_verify_signature_secp256k1(
@@ -79,6 +90,9 @@ uint32_t mb_verify_signature_secp256k1(
         const message_digest_t digest[1]);
 
 #define sha256_buffer mb_sha256_buffer
+#define sha256_start mb_sha256_start
+#define sha256_update mb_sha256_update
+#define sha256_finish mb_sha256_finish
 #define aes256_buffer mb_aes256_buffer
 #define sign_sha256 mb_sign_sha256
 #define verify_signature_secp256k1 mb_verify_signature_secp256k1
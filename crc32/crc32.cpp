@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2025 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "crc32.h"
+
+namespace {
+    // Tables for slicing-by-8: table[k][b] is the CRC of byte b followed by k zero bytes, so eight bytes can be
+    // processed with eight independent lookups
+    struct crc32_tables {
+        uint32_t table[8][0x100];
+
+        crc32_tables() {
+            const uint32_t POLYNOMIAL = 0x4C11DB7;
+            for (unsigned int i = 0; i < 0x100; i++) {
+                uint32_t remainder = i << 24u;
+                for (unsigned int bit = 8; bit > 0; bit--) {
+                    if (remainder & 0x80000000)
+                        remainder = (remainder << 1) ^ POLYNOMIAL;
+                    else
+                        remainder = (remainder << 1);
+                }
+                table[0][i] = remainder;
+            }
+            for (unsigned int k = 1; k < 8; k++) {
+                for (unsigned int i = 0; i < 0x100; i++) {
+                    uint32_t prev = table[k - 1][i];
+                    table[k][i] = (prev << 8u) ^ table[0][prev >> 24u];
+                }
+            }
+        }
+    };
+
+    const crc32_tables &get_tables() {
+        // initialized once, on first use (thread safe)
+        static const crc32_tables tables;
+        return tables;
+    }
+}
+
+uint32_t crc32_sw(const uint8_t *buf, size_t count, uint32_t crc) {
+    const auto &t = get_tables().table;
+    for (; count >= 8; count -= 8, buf += 8) {
+        crc ^= (uint32_t)buf[0] << 24u | (uint32_t)buf[1] << 16u | (uint32_t)buf[2] << 8u | buf[3];
+        crc = t[7][crc >> 24u] ^ t[6][(uint8_t)(crc >> 16u)] ^ t[5][(uint8_t)(crc >> 8u)] ^ t[4][(uint8_t)crc] ^
+              t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+    }
+    for (; count; count--) {
+        crc = (crc << 8u) ^ t[0][(uint8_t)((crc >> 24u) ^ *buf++)];
+    }
+    return crc;
+}
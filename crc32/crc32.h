@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) 2025 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _CRC32_H
+#define _CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32 with polynomial 0x04c11db7, MSB first and no final XOR (as used for the boot2 checksum, with an initial value
+// of 0xffffffff). Safe to call from several threads.
+uint32_t crc32_sw(const uint8_t *buf, size_t count, uint32_t crc);
+
+#endif
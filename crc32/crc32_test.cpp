@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2025 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Checks crc32_sw against the bit-at-a-time CRC it replaced, and against the reflected CRC bintool used to use for
+// the boot2 checksum
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "crc32.h"
+
+namespace {
+    // the original picoboot_connection implementation, one bit at a time
+    uint32_t crc32_bitwise(const uint8_t *buf, size_t count, uint32_t crc) {
+        const uint32_t POLYNOMIAL = 0x4C11DB7;
+        while (count--) {
+            crc ^= (uint32_t)*buf++ << 24u;
+            for (unsigned int bit = 8; bit > 0; bit--) {
+                if (crc & 0x80000000)
+                    crc = (crc << 1) ^ POLYNOMIAL;
+                else
+                    crc = (crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    uint8_t rev_8(uint8_t b) {
+        b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+        b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+        b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+        return b;
+    }
+
+    uint32_t rev_32(uint32_t b) {
+        return (uint32_t)rev_8(b) << 24 | rev_8(b >> 8) << 16 | rev_8(b >> 16) << 8 | rev_8(b >> 24);
+    }
+
+    // the original bintool calc_checksum: a reflected CRC of the bit reversed data, bit reversed
+    uint32_t calc_checksum_reflected(const uint8_t *data) {
+        uint32_t table[256];
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++) c = c & 1 ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+            table[i] = c;
+        }
+        uint32_t crc = 0xffffffff;
+        for (int i = 0; i < 252; i++) crc = table[(uint8_t)crc ^ rev_8(data[i])] ^ (crc >> 8);
+        return rev_32(crc);
+    }
+
+    int failures = 0;
+
+    void check(const char *what, size_t len, uint32_t got, uint32_t expected) {
+        if (got != expected) {
+            printf("FAIL: %s, length %zu: got %08x, expected %08x\n", what, len, got, expected);
+            failures++;
+        }
+    }
+}
+
+int main() {
+    // the CRC-32/MPEG-2 check value
+    const uint8_t check_string[] = "123456789";
+    uint32_t crc = crc32_sw(check_string, 9, 0xffffffff);
+    check("check string", 9, crc, 0x0376e6e7);
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> buf(4096 + 8);
+    for (auto &b : buf) b = rng();
+
+    // every length and alignment around the 8 byte slices, then random lengths and initial values
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t len = 0; len <= 64; len++) {
+            uint32_t got = crc32_sw(buf.data() + offset, len, 0xffffffff);
+            uint32_t expected = crc32_bitwise(buf.data() + offset, len, 0xffffffff);
+            check("crc32_sw", len, got, expected);
+        }
+    }
+    for (int i = 0; i < 1000; i++) {
+        size_t offset = rng() % 8;
+        size_t len = rng() % (buf.size() - offset + 1);
+        uint32_t initial = rng();
+        uint32_t got = crc32_sw(buf.data() + offset, len, initial);
+        uint32_t expected = crc32_bitwise(buf.data() + offset, len, initial);
+        check("crc32_sw", len, got, expected);
+    }
+
+    // the boot2 checksum, of erased flash, of zeros, and of random data
+    std::vector<uint8_t> boot2(252, 0xff);
+    for (int i = 0; i < 102; i++) {
+        if (i == 1) std::fill(boot2.begin(), boot2.end(), 0);
+        if (i >= 2) for (auto &b : boot2) b = rng();
+        uint32_t got = crc32_sw(boot2.data(), boot2.size(), 0xffffffff);
+        uint32_t expected = calc_checksum_reflected(boot2.data());
+        check("boot2 checksum", boot2.size(), got, expected);
+    }
+
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("crc32 tests passed\n");
+    return 0;
+}
@@ -188,10 +188,14 @@ int rp_determine_binary_type(const elf32_header &eh, const std::vector<elf32_ph_
     return ERROR_INCOMPATIBLE;
 }
 
-void elf_file::read_bytes(unsigned offset, unsigned length, void *dest) {
+void elf_file::check_bytes(unsigned offset, unsigned length) const {
     if (offset + length > elf_bytes.size()) {
         fail(ERROR_FORMAT, "ELF File Read from 0x%x with size 0x%x exceeds the file size 0x%zx", offset, length, elf_bytes.size());
     }
+}
+
+void elf_file::read_bytes(unsigned offset, unsigned length, void *dest) {
+    check_bytes(offset, length);
     memcpy(dest, &elf_bytes[offset], length);
 }
 
@@ -201,43 +205,96 @@ int elf_file::read_header(void) {
     return rp_check_elf_header(eh);
 }
 
-// Flattens the data in the section array the elf_bytes blob
-void elf_file::flatten(void) {
-    elf_bytes.resize(sizeof(eh));
-    auto eh_out = eh;
+// The parts of the file (headers and section data) in the order they are laid out, with later parts overwriting earlier
+// ones. The headers are swapped to LE into the storage passed in
+std::vector<elf_file::file_part> elf_file::layout(elf32_header &eh_out, std::vector<elf32_ph_entry> &ph_entries_out,
+                                                  std::vector<elf32_sh_entry> &sh_entries_out) const {
+    std::vector<file_part> parts;
+    eh_out = eh;
     eh_le(eh_out);    // swap to LE for writing
-    memcpy(&elf_bytes[0], &eh_out, sizeof(eh_out));
+    parts.push_back({0, (const uint8_t *)&eh_out, sizeof(eh_out)});
 
-    elf_bytes.resize(std::max(eh.ph_offset + sizeof(elf32_ph_entry) * eh.ph_num, elf_bytes.size()));
-    auto ph_entries_out = ph_entries;
+    ph_entries_out = ph_entries;
     for (auto ph : ph_entries_out) {
         ph_le(ph);  // swap to LE for writing
     }
-    memcpy(&elf_bytes[eh.ph_offset], &ph_entries_out[0], sizeof(elf32_ph_entry) * eh.ph_num);
+    parts.push_back({eh.ph_offset, (const uint8_t *)ph_entries_out.data(), (uint32_t)sizeof(elf32_ph_entry) * eh.ph_num});
 
-    elf_bytes.resize(std::max(eh.sh_offset + sizeof(elf32_sh_entry) * eh.sh_num, elf_bytes.size()));
-    auto sh_entries_out = sh_entries;
+    sh_entries_out = sh_entries;
     for (auto sh : sh_entries_out) {
         sh_le(sh);  // swap to LE for writing
     }
-    memcpy(&elf_bytes[eh.sh_offset], &sh_entries_out[0], sizeof(elf32_sh_entry) * eh.sh_num);
+    parts.push_back({eh.sh_offset, (const uint8_t *)sh_entries_out.data(), (uint32_t)sizeof(elf32_sh_entry) * eh.sh_num});
 
-    int idx = 0;
-    for (const auto &sh : sh_entries) {
+    for (unsigned int idx = 0; idx < sh_entries.size(); idx++) {
+        const auto &sh = sh_entries[idx];
         if (sh.size && sh.type != SHT_NOBITS) {
-            elf_bytes.resize(std::max(sh.offset + sh.size, (uint32_t)elf_bytes.size()));
-            memcpy(&elf_bytes[sh.offset], &sh_data[idx][0], sh.size);
+            parts.push_back({sh.offset, section_data(idx), sh.size});
         }
-        idx++;
     }
+    return parts;
+}
+
+// Flattens the headers and section data into the elf_bytes blob
+void elf_file::flatten(void) {
+    elf32_header eh_out;
+    std::vector<elf32_ph_entry> ph_entries_out;
+    std::vector<elf32_sh_entry> sh_entries_out;
+    auto parts = layout(eh_out, ph_entries_out, sh_entries_out);
+
+    // sections which haven't been modified are still in elf_bytes, so build the new blob separately
+    std::vector<uint8_t> flat;
+    for (const auto &part : parts) {
+        flat.resize(std::max((size_t)part.offset + part.size, flat.size()));
+        if (part.size) memcpy(&flat[part.offset], part.data, part.size);
+    }
+    elf_bytes.swap(flat);
+    read_sh_data();
     if (verbose) printf("Elf file size %zu\n", elf_bytes.size());
 }
 
 void elf_file::write(std::shared_ptr<std::iostream> out) {
-    flatten();
     out->exceptions(std::iostream::failbit | std::iostream::badbit);
-    if (verbose) printf("Writing %lu bytes to file\n", elf_bytes.size());
-    out->write(reinterpret_cast<const char*>(&elf_bytes[0]), elf_bytes.size());
+    elf32_header eh_out;
+    std::vector<elf32_ph_entry> ph_entries_out;
+    std::vector<elf32_sh_entry> sh_entries_out;
+    auto parts = layout(eh_out, ph_entries_out, sh_entries_out);
+    std::stable_sort(parts.begin(), parts.end(), [](const file_part &a, const file_part &b) {
+        return a.offset < b.offset;
+    });
+    bool overlapping = false;
+    size_t size = 0;
+    for (const auto &part : parts) {
+        overlapping |= part.size && part.offset < size;
+        size = std::max(size, (size_t)part.offset + part.size);
+    }
+    if (overlapping) {
+        // let flatten resolve which part wins
+        flatten();
+        if (verbose) printf("Writing %lu bytes to file\n", elf_bytes.size());
+        out->write(reinterpret_cast<const char*>(&elf_bytes[0]), elf_bytes.size());
+        return;
+    }
+
+    // write each part straight from where it is, rather than flattening a copy of the whole file first
+    if (verbose) printf("Elf file size %zu\n", size);
+    if (verbose) printf("Writing %lu bytes to file\n", size);
+    static const char zeros[4096] = {};
+    size_t pos = 0;
+    for (const auto &part : parts) {
+        while (pos < part.offset) {
+            size_t len = std::min(sizeof(zeros), part.offset - pos);
+            out->write(zeros, len);
+            pos += len;
+        }
+        out->write(reinterpret_cast<const char*>(part.data), part.size);
+        pos += part.size;
+    }
+    while (pos < size) {
+        size_t len = std::min(sizeof(zeros), size - pos);
+        out->write(zeros, len);
+        pos += len;
+    }
 }
 
 void elf_file::read_sh(void) {
@@ -338,58 +395,111 @@ void elf_file::remove_empty_ph_entries(void) {
     }
 }
 
-// Read the section data from the internal byte array into discrete sections.
+// Note where each section's data is in the internal byte array, dropping any modified copies. The data is only copied
+// out of the byte array when a section is modified, so large sections which are never used (e.g. debug info) cost nothing.
 // This is used after modifying segments but before inserting new segments
 void elf_file::read_sh_data(void) {
     int sh_idx = 0;
+    sh_data.clear();
     sh_data.resize(eh.sh_num);
+    sh_data_offset.resize(eh.sh_num);
     for (const auto &sh: sh_entries) {
         if (sh.size && sh.type != SHT_NOBITS) {
-            sh_data[sh_idx].resize(sh.size);
-            read_bytes(sh.offset, sh.size, &sh_data[sh_idx][0]);
+            check_bytes(sh.offset, sh.size);
         }
+        sh_data_offset[sh_idx] = sh.offset;
         sh_idx++;
     }
 }
 
+const uint8_t *elf_file::section_data(unsigned int idx) const {
+    if (!sh_data[idx].empty()) return sh_data[idx].data();
+    return elf_bytes.data() + sh_data_offset[idx];
+}
+
+// Copy a section's data out of the internal byte array, so it can be modified
+std::vector<uint8_t> &elf_file::modifiable_section_data(unsigned int idx) {
+    auto &data = sh_data[idx];
+    if (data.empty() && sh_entries[idx].size && sh_entries[idx].type != SHT_NOBITS) {
+        const uint8_t *from = elf_bytes.data() + sh_data_offset[idx];
+        data.assign(from, from + sh_entries[idx].size);
+    }
+    return data;
+}
+
 const std::string elf_file::section_name(uint32_t sh_name) const {
     if (!eh.sh_str_index || eh.sh_str_index > eh.sh_num || eh.sh_str_index >= sh_data.size())
         return "";
 
-    if (sh_name > sh_data[eh.sh_str_index].size())
+    if (sh_name > sh_entries[eh.sh_str_index].size)
         return "";
 
-    const char * str =(const char *) &sh_data[eh.sh_str_index][0];
+    const char * str =(const char *) section_data(eh.sh_str_index);
     return &str[sh_name];
 }
 
-const elf32_sh_entry* elf_file::get_section(const std::string &sh_name) {
+void elf_file::index_sections(void) {
+    section_indexes.clear();
     for (unsigned int i = 0; i < sh_entries.size(); i++) {
-        if (section_name(sh_entries[i].name) == sh_name) {
-            return &sh_entries[i];
-        }
+        section_indexes.emplace(section_name(sh_entries[i].name), i);
     }
-    return NULL;
+    sections_indexed = true;
 }
 
-uint32_t elf_file::get_symbol(const std::string &sym_name) {
+void elf_file::index_symbols(void) {
+    symbol_values.clear();
+    symbols_indexed = true;
     auto sym_tab = get_section(".symtab");
     auto str_tab = get_section(".strtab");
     if (!sym_tab || !str_tab) {
-        return 0;
+        return;
     }
-    auto data = content(*sym_tab);
-    auto strings = content(*str_tab);
-    const char * str =(const char *) strings.data();
+    const uint8_t *data = section_data(sym_tab - &sh_entries[0]);
+    const char * str = (const char *) section_data(str_tab - &sh_entries[0]);
+    symbol_values.reserve(sym_tab->size / sizeof(elf32_sym_entry));
     for (unsigned int i=0; i < sym_tab->size / sizeof(elf32_sym_entry); i++) {
         elf32_sym_entry sym;
-        memcpy(&sym, data.data() + i*sizeof(elf32_sym_entry), sizeof(elf32_sym_entry));
+        memcpy(&sym, data + i*sizeof(elf32_sym_entry), sizeof(elf32_sym_entry));
         sym_he(sym);    // swap to Host for processing
-        if (&str[sym.name] == sym_name) {
-            return sym.value;
+        if (sym.name < str_tab->size) {
+            symbol_values.emplace(std::string(&str[sym.name], strnlen(&str[sym.name], str_tab->size - sym.name)), sym.value);
         }
     }
-    return 0;
+}
+
+// Names only change when the content is updated (appended sections are added to the index directly)
+void elf_file::clear_indexes(void) {
+    sections_indexed = false;
+    symbols_indexed = false;
+    section_indexes.clear();
+    symbol_values.clear();
+}
+
+const elf32_sh_entry* elf_file::get_section(const std::string &sh_name) {
+    if (!sections_indexed) index_sections();
+    auto it = section_indexes.find(sh_name);
+    if (it == section_indexes.end()) {
+        return NULL;
+    }
+    return &sh_entries[it->second];
+}
+
+uint32_t elf_file::get_symbol(const std::string &sym_name) {
+    if (!symbols_indexed) index_symbols();
+    auto it = symbol_values.find(sym_name);
+    if (it == symbol_values.end()) {
+        return 0;
+    }
+    return it->second;
+}
+
+std::vector<uint32_t> elf_file::get_symbols(const std::vector<std::string> &sym_names) {
+    std::vector<uint32_t> values;
+    values.reserve(sym_names.size());
+    for (const auto &sym_name : sym_names) {
+        values.push_back(get_symbol(sym_name));
+    }
+    return values;
 }
 
 uint32_t elf_file::append_section_name(const std::string &sh_name_str) {
@@ -400,7 +510,7 @@ uint32_t elf_file::append_section_name(const std::string &sh_name_str) {
     // Append the byte array to section header table remembering the offset
     // of the start of the string for the new section
     elf32_sh_entry &shstrtab = sh_entries[eh.sh_str_index];
-    std::vector<uint8_t> &shstrtab_data = sh_data[eh.sh_str_index];
+    std::vector<uint8_t> &shstrtab_data = modifiable_section_data(eh.sh_str_index);
     sh_entries[eh.sh_str_index].size += name_bytes.size();
     uint32_t sh_name = shstrtab_data.size();
     shstrtab_data.insert(shstrtab_data.end(), name_bytes.begin(), name_bytes.end());
@@ -455,6 +565,7 @@ int elf_file::read_file(std::shared_ptr<std::iostream> file) {
     int rc = 0;
     try {
         elf_bytes = read_binfile(file);
+        clear_indexes();
         int rc = read_header();
         if (!rc) {
             read_ph();
@@ -495,6 +606,11 @@ std::vector<uint8_t> elf_file::content(const elf32_ph_entry &ph) const {
     return content;
 }
 
+const uint8_t *elf_file::content_data(const elf32_ph_entry &ph) const {
+    check_bytes(ph.offset, ph.filez);
+    return elf_bytes.data() + ph.offset;
+}
+
 std::vector<uint8_t> elf_file::content(const elf32_sh_entry &sh) const {
     std::vector<uint8_t> content;
     std::copy(elf_bytes.begin() + sh.offset, elf_bytes.begin() + sh.offset + sh.size, std::back_inserter(content));
@@ -507,6 +623,7 @@ void elf_file::content(const elf32_ph_entry &ph, const std::vector<uint8_t> &con
     if (verbose) printf("Update segment content offset %x content size %zx physical size %x\n", ph.offset, content.size(), ph.filez);
     memcpy(&elf_bytes[ph.offset], &content[0], std::min(content.size(), (size_t) ph.filez));
     read_sh_data(); // Extract the sections after modifying the content
+    clear_indexes();
 }
 
 void elf_file::content(const elf32_sh_entry &sh, const std::vector<uint8_t> &content) {
@@ -515,6 +632,7 @@ void elf_file::content(const elf32_sh_entry &sh, const std::vector<uint8_t> &con
     if (verbose) printf("Update section content offset %x content size %zx section size %x\n", sh.offset, content.size(), sh.size);
     memcpy(&elf_bytes[sh.offset], &content[0], std::min(content.size(), (size_t) sh.size));
     read_sh_data();  // Extract the sections after modifying the content
+    clear_indexes();
 }
 
 const elf32_ph_entry* elf_file::segment_from_physical_address(uint32_t paddr) {
@@ -633,7 +751,7 @@ void elf_file::store_squashed(model_t model) {
 // Use content to replace the content
 const elf32_ph_entry& elf_file::append_segment(uint32_t vaddr, uint32_t paddr, uint32_t size, const std::string &name) {
     elf32_ph_entry ph;
-    read_sh_data(); // Convert the section data back into discreet chunks
+    read_sh_data(); // Note where the section data is, before any sections are moved
     uint32_t sh_name = append_section_name(name);
 
     ph.type = PT_LOAD;
@@ -682,7 +800,9 @@ const elf32_ph_entry& elf_file::append_segment(uint32_t vaddr, uint32_t paddr, u
 
     // Add the new segment for the signature and point to offset in file for data
     sh_entries.push_back(sh);
+    if (sections_indexed) section_indexes.emplace(name, sh_entries.size() - 1);
     sh_data.push_back(std::vector<uint8_t>(size));
+    sh_data_offset.push_back(0);
     ph_entries.back().offset = sh.offset;
 
     eh.sh_offset = sh.offset + sh.size;
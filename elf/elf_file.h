@@ -14,6 +14,7 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include "elf.h"
 #include "model.h"
@@ -31,9 +32,13 @@ public:
     const elf32_header &header(void) const {return eh;}
     const std::vector<elf32_ph_entry> &segments(void) const {return ph_entries;}
     const std::vector<elf32_sh_entry> &sections(void) const {return sh_entries;}
+    // the file contents
+    const std::vector<uint8_t> &bytes(void) const {return elf_bytes;}
 
     std::vector<uint8_t> content(const elf32_ph_entry &ph) const;
     std::vector<uint8_t> content(const elf32_sh_entry &sh) const;
+    // the segment's file contents in place, without copying them (valid until the file is next modified)
+    const uint8_t *content_data(const elf32_ph_entry &ph) const;
     std::vector<const elf32_ph_entry *> sorted_segments(void);
     void content(const elf32_ph_entry &ph, const std::vector<uint8_t> &content);
     void content(const elf32_sh_entry &sh, const std::vector<uint8_t> &content);
@@ -42,6 +47,8 @@ public:
     uint32_t highest_section_offset(void) const;
     const elf32_sh_entry* get_section(const std::string &sh_name);
     uint32_t get_symbol(const std::string &sym_name);
+    // look up several symbols at once; missing symbols are 0, as for get_symbol
+    std::vector<uint32_t> get_symbols(const std::vector<std::string> &sym_names);
     const std::string section_name(uint32_t sh_name) const;
     const elf32_ph_entry* segment_from_physical_address(uint32_t paddr);
     const elf32_ph_entry* segment_from_virtual_address(uint32_t vaddr);
@@ -58,21 +65,42 @@ public:
 
     bool editable = true;
 private:
+    struct file_part {
+        uint32_t offset;
+        const uint8_t *data;
+        uint32_t size;
+    };
+
     std::vector<elf32_ph_entry *> sorted_segments_modifiable(void);
     int read_header(void);
     void read_ph(void);
     void read_sh(void);
     void read_sh_data(void);
+    const uint8_t *section_data(unsigned int idx) const;
+    std::vector<uint8_t> &modifiable_section_data(unsigned int idx);
+    void check_bytes(unsigned offset, unsigned length) const;
     void read_bytes(unsigned offset, unsigned length, void *dest);
     uint32_t append_section_name(const std::string &sh_name_str);
+    std::vector<file_part> layout(elf32_header &eh_out, std::vector<elf32_ph_entry> &ph_entries_out,
+                                  std::vector<elf32_sh_entry> &sh_entries_out) const;
     void flatten(void);
+    void index_sections(void);
+    void index_symbols(void);
+    void clear_indexes(void);
 
 private:
     elf32_header eh;
     std::vector<uint8_t> elf_bytes;
     std::vector<elf32_ph_entry> ph_entries;
     std::vector<elf32_sh_entry> sh_entries;
+    // modified copies of section data; unmodified sections are read from elf_bytes at sh_data_offset
     std::vector<std::vector<uint8_t>> sh_data;
+    std::vector<uint32_t> sh_data_offset;
+    // name lookups, built on first use; the first section or symbol with a given name wins
+    std::unordered_map<std::string, unsigned int> section_indexes;
+    std::unordered_map<std::string, uint32_t> symbol_values;
+    bool sections_indexed = false;
+    bool symbols_indexed = false;
     bool verbose;
 };
 int rp_check_elf_header(const elf32_header &eh);
@@ -14,12 +14,18 @@
 #include <cstring>
 #include <memory>
 #include <cinttypes>
+#include <thread>
 
 #include "elf2uf2.h"
 #include "errors.h"
 #include "model.h"
 
 #define FLASH_SECTOR_ERASE_SIZE 4096u
+// UF2 blocks are built by up to this many threads, each with at least UF2_MIN_PAGES_PER_THREAD pages
+#define UF2_MAX_THREADS 8u
+#define UF2_MIN_PAGES_PER_THREAD 1024u
+// UF2 blocks are written this many at a time
+#define UF2_WRITE_CHUNK_BLOCKS 256u
 
 static bool g_verbose;
 
@@ -104,18 +110,13 @@ int check_elf32_ph_entries(const std::vector<elf32_ph_entry>& entries, const add
     return 0;
 }
 
-int realize_page(std::shared_ptr<std::iostream> in, const std::vector<page_fragment> &fragments, uint8_t *buf, unsigned int buf_len) {
+// data is the whole input file; the fragments must already have been checked against its size
+int realize_page(const std::vector<uint8_t> &data, const std::vector<page_fragment> &fragments, uint8_t *buf, unsigned int buf_len) {
     assert(buf_len >= UF2_PAGE_SIZE);
     for(auto& frag : fragments) {
         assert(frag.page_offset < UF2_PAGE_SIZE && frag.page_offset + frag.bytes <= UF2_PAGE_SIZE);
-        in->seekg(frag.file_offset, in->beg);
-        if (in->fail()) {
-            fail_read_error();
-        }
-        in->read((char*)buf + frag.page_offset, frag.bytes);
-        if (in->fail()) {
-            fail_read_error();
-        }
+        assert((uint64_t)frag.file_offset + frag.bytes <= data.size());
+        memcpy(buf + frag.page_offset, data.data() + frag.file_offset, frag.bytes);
     }
     return 0;
 }
@@ -157,7 +158,7 @@ bool check_abs_block(uf2_block block) {
         !(block.flags & UF2_FLAG_EXTENSION_FLAGS_PRESENT && *(uint32_t*)&(block.data[UF2_PAGE_SIZE]) != UF2_EXTENSION_RP2_IGNORE_BLOCK);
 }
 
-int pages2uf2(std::map<uint32_t, std::vector<page_fragment>>& pages, std::shared_ptr<std::iostream> in, std::shared_ptr<std::iostream> out, uint32_t family_id, model_t model, uint32_t abs_block_loc=0) {
+int pages2uf2(std::map<uint32_t, std::vector<page_fragment>>& pages, const std::vector<uint8_t> &data, std::shared_ptr<std::iostream> out, uint32_t family_id, model_t model, uint32_t abs_block_loc=0) {
     // RP2350-E10: add absolute block to start of flash UF2s, targeting end of flash by default
     if (family_id != ABSOLUTE_FAMILY_ID && model->chip() == rp2350 && abs_block_loc) {
         uint32_t base_addr = pages.begin()->first;
@@ -170,26 +171,59 @@ int pages2uf2(std::map<uint32_t, std::vector<page_fragment>>& pages, std::shared
             }
         }
     }
-    uf2_block block;
-    unsigned int page_num = 0;
-    block.magic_start0 = UF2_MAGIC_START0;
-    block.magic_start1 = UF2_MAGIC_START1;
-    block.flags = UF2_FLAG_FAMILY_ID_PRESENT;
-    block.payload_size = UF2_PAGE_SIZE;
-    block.num_blocks = (uint32_t)pages.size();
-    block.file_size = family_id;
-    block.magic_end = UF2_MAGIC_END;
-    for(auto& page_entry : pages) {
-        block.target_addr = page_entry.first;
-        block.block_no = page_num++;
+    uf2_block header;
+    header.magic_start0 = UF2_MAGIC_START0;
+    header.magic_start1 = UF2_MAGIC_START1;
+    header.flags = UF2_FLAG_FAMILY_ID_PRESENT;
+    header.payload_size = UF2_PAGE_SIZE;
+    header.num_blocks = (uint32_t)pages.size();
+    header.file_size = family_id;
+    header.magic_end = UF2_MAGIC_END;
+    memset(header.data, 0, sizeof(header.data));
+
+    // check all the fragments up front, so that the blocks can be built without any failures
+    std::vector<std::pair<uint32_t, const std::vector<page_fragment> *>> page_list;
+    page_list.reserve(pages.size());
+    for(const auto& page_entry : pages) {
+        for(const auto& frag : page_entry.second) {
+            if ((uint64_t)frag.file_offset + frag.bytes > data.size()) {
+                fail_read_error();
+            }
+        }
         if (g_verbose) {
-            printf("Page %d / %d %08x%s\n", block.block_no, block.num_blocks, block.target_addr,
+            printf("Page %d / %d %08x%s\n", (int)page_list.size(), header.num_blocks, page_entry.first,
                    page_entry.second.empty() ? " (padding)": "");
         }
-        memset(block.data, 0, sizeof(block.data));
-        int rc = realize_page(in, page_entry.second, block.data, sizeof(block.data));
-        if (rc) return rc;
-        out->write((char*)&block, sizeof(uf2_block));
+        page_list.emplace_back(page_entry.first, &page_entry.second);
+    }
+
+    // each block only depends on its own page, so large inputs are split between threads
+    std::vector<uf2_block> blocks(page_list.size());
+    auto build_blocks = [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; i++) {
+            uf2_block &block = blocks[i];
+            block = header;
+            block.target_addr = page_list[i].first;
+            block.block_no = (uint32_t)i;
+            realize_page(data, *page_list[i].second, block.data, sizeof(block.data));
+        }
+    };
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::min(num_threads, (size_t)UF2_MAX_THREADS);
+    num_threads = std::max((size_t)1, std::min(num_threads, blocks.size() / UF2_MIN_PAGES_PER_THREAD));
+    size_t per_thread = (blocks.size() + num_threads - 1) / num_threads;
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; t++) {
+        threads.emplace_back(build_blocks, std::min(blocks.size(), t * per_thread), std::min(blocks.size(), (t + 1) * per_thread));
+    }
+    build_blocks(0, std::min(blocks.size(), per_thread));
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < blocks.size(); i += UF2_WRITE_CHUNK_BLOCKS) {
+        size_t count = std::min(blocks.size() - i, (size_t)UF2_WRITE_CHUNK_BLOCKS);
+        out->write((char*)&blocks[i], count * sizeof(uf2_block));
         if (out->fail()) {
             fail_write_error();
         }
@@ -209,6 +243,12 @@ int bin2uf2(std::shared_ptr<std::iostream> in, std::shared_ptr<std::iostream> ou
     if (size <= 0) {
         fail_read_error();
     }
+    std::vector<uint8_t> data(size);
+    in->seekg(0, in->beg);
+    in->read((char*)data.data(), size);
+    if (in->fail()) {
+        fail_read_error();
+    }
 
     unsigned int addr = address;
     unsigned int remaining = size;
@@ -233,7 +273,7 @@ int bin2uf2(std::shared_ptr<std::iostream> in, std::shared_ptr<std::iostream> ou
         remaining -= len;
     }
 
-    return pages2uf2(pages, in, out, family_id, model, abs_block_loc);
+    return pages2uf2(pages, data, out, family_id, model, abs_block_loc);
 }
 
 int elf2uf2(std::shared_ptr<std::iostream> in, std::shared_ptr<std::iostream> out, uint32_t family_id, model_t model, uint32_t package_addr, uint32_t abs_block_loc, bool verbose) {
@@ -289,7 +329,7 @@ int elf2uf2(std::shared_ptr<std::iostream> in, std::shared_ptr<std::iostream> ou
         // todo can be re-enabled for RP2350
 #if 0
         uint8_t buf[UF2_PAGE_SIZE];
-        rc = realize_page(in, pages[SRAM_START], buf, sizeof(buf));
+        rc = realize_page(elf->bytes(), pages[SRAM_START], buf, sizeof(buf));
         if (rc) return rc;
         uint32_t sp = ((uint32_t *)buf)[0];
         uint32_t ip = ((uint32_t *)buf)[1];
@@ -339,5 +379,5 @@ int elf2uf2(std::shared_ptr<std::iostream> in, std::shared_ptr<std::iostream> ou
         }
     }
 
-    return pages2uf2(pages, in, out, family_id, model, abs_block_loc);
+    return pages2uf2(pages, elf->bytes(), out, family_id, model, abs_block_loc);
 }
@@ -2461,6 +2461,25 @@
  */
 #define MBEDTLS_AESNI_C
 
+/**
+ * \def MBEDTLS_AESCE_C
+ *
+ * Enable AES cryptographic extension support on Armv8.
+ *
+ * Only known to Mbed TLS 3.x, where it is ignored on other targets, and the
+ * extension is detected at runtime on Linux, Windows and macOS.
+ * MBEDTLS_VERSION_NUMBER is defined before this file is included by 3.x,
+ * but not by 2.x.
+ *
+ * Module:  library/aesce.c
+ * Caller:  library/aes.c
+ *
+ * Requires: MBEDTLS_HAVE_ASM, MBEDTLS_AES_C
+ */
+#if defined(MBEDTLS_VERSION_NUMBER) && MBEDTLS_VERSION_NUMBER >= 0x03060000
+#define MBEDTLS_AESCE_C
+#endif
+
 /**
  * \def MBEDTLS_AES_C
  *
@@ -3488,6 +3507,24 @@
  */
 #define MBEDTLS_SHA256_C
 
+/**
+ * \def MBEDTLS_SHA256_USE_ARMV8_A_CRYPTO_IF_PRESENT
+ *
+ * Enable acceleration of SHA-224 and SHA-256 with the Armv8 cryptographic
+ * extensions when they are found at runtime, falling back to the C
+ * implementation otherwise.
+ *
+ * Only known to Mbed TLS 3.x (see MBEDTLS_AESCE_C above), and ignored on
+ * non-Armv8 targets.
+ *
+ * Module:  library/sha256.c
+ *
+ * Requires: MBEDTLS_SHA256_C
+ */
+#if defined(MBEDTLS_VERSION_NUMBER) && MBEDTLS_VERSION_NUMBER >= 0x03060000
+#define MBEDTLS_SHA256_USE_ARMV8_A_CRYPTO_IF_PRESENT
+#endif
+
 /**
  * \def MBEDTLS_SHA512_C
  *
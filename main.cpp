@@ -23,6 +23,11 @@
 #include <iostream>
 #include <vector>
 #include <set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <array>
 #include <cstring>
 #include <cstdarg>
@@ -45,6 +50,7 @@
     #include "picoboot_connection.h"
 #endif
 #include "bintool.h"
+#include "crc32.h"
 #include "elf2uf2.h"
 #include "boot/bootrom_constants.h"
 #include "pico/binary_info.h"
@@ -85,7 +91,41 @@ static __forceinline int __builtin_ctz(unsigned x) {
 #define STR(x) STR_HELPER(x)
 
 
-#define MAX_REBOOT_TRIES 5
+// How long to wait for a device to reappear after rebooting it into BOOTSEL mode
+#define REBOOT_TIMEOUT_MS 6000
+// While waiting, re-enumerate after this long, doubling up to the maximum; with libusb hotplug support we also
+// re-enumerate as soon as any device arrives
+#define REBOOT_POLL_MIN_MS 100
+#define REBOOT_POLL_MAX_MS 800
+
+// Cached flash reads from the device fetch at least this much, and prefetches read across gaps of up to this much
+#define FLASH_READ_AHEAD_SIZE 1024u
+#define FLASH_PREFETCH_MAX_GAP 1024u
+// Cached ROM reads from the device fetch at least this much
+#define ROM_READ_AHEAD_SIZE 1024u
+// RP2040 ROM reads ending at or above this are done by running memcpy on the device to copy the whole ROM
+#define RP2040_ROM_DIRECT_READ_END 0x2000u
+// Serial flash commands and the SFDP (JESD216) Basic Flash Parameter Table, used to find the flash geometry
+#define FLASH_JEDEC_ID_CMD 0x9f
+#define FLASH_READ_SFDP_CMD 0x5a
+#define FLASH_SECTOR_ERASE_CMD 0x20
+#define FLASH_BLOCK_ERASE_CMD 0xd8
+#define FLASH_WRITE_ENABLE_CMD 0x06
+#define FLASH_READ_STATUS_CMD 0x05
+#define SFDP_SIGNATURE 0x50444653u // "SFDP"
+#define SFDP_BFPT_MIN_DWORDS 9
+// The flash geometry probe reads this much of the SFDP, which normally includes the Basic Flash Parameter Table
+#define SFDP_READ_LEN 256u
+// Freshly erased flash already reads as 0xff, so runs of at least this many 0xff bytes aren't sent when loading;
+// shorter runs are sent anyway, as another write command costs about as much as programming them
+#define FLASH_BLANK_SKIP_MIN 1024u
+// When flash is programmed by sending compressed data, it is expanded and programmed by the device in (aligned)
+// blocks of at most this size, so each exec'd program finishes well within the command timeout
+#define FLASH_COMPRESSED_BATCH_SIZE (64u * 1024u)
+// Large erases are split into commands of this size, so that progress can be shown
+#define FLASH_ERASE_MAX_COMMAND_SIZE (256u * 1024u)
+// UF2 files are scanned this many blocks at a time
+#define UF2_SCAN_CHUNK_BLOCKS 128u
 
 #define OTP_PAGE_COUNT 64
 #define OTP_PAGE_ROWS  64
@@ -292,7 +332,8 @@ struct range {
 
 };
 
-// ranges should not overlap
+// ranges should not overlap. The entries are kept in a vector sorted by address, and any that are contiguous in both
+// address and mapped value (e.g. consecutive ELF segment data) are merged into one
 template <typename T> struct range_map {
     range_map() = default;
     struct mapping {
@@ -304,18 +345,33 @@ template <typename T> struct range_map {
     void insert(const range& r, T t) {
         if (r.to != r.from) {
             assert(r.to > r.from);
+            if (is_after_last(r)) {
+                append(r, t);
+                return;
+            }
             // check we don't overlap any existing map entries
+            normalize();
+            auto f = first_ending_after(r.from);
+            if (f != entries.end() && f->from < r.to) {
+                fail_overlap(r, range(f->from, f->to));
+            }
+            entries.insert(f, entry{r.from, r.to, t});
+        }
+    }
 
-            auto f = m.upper_bound(r.from); // first element that starts after r.from
-            if (f != m.begin()) f--; // back up, to catch element that starts on or before r.from
-            for(; f != m.end() && f->first < r.to; f++) { // loop till we can't possibly overlap
-                range r2(f->first, f->second.first);
-                if (r2.intersects(r)) {
-                    fail(ERROR_FORMAT, "Found overlapping memory ranges 0x%08x->0x%08x and 0x%08x->%08x\n",
-                         r.from, r.to, r2.from, r2.to);
-                }
+    // Add a mapping without checking it against the others yet, for building large maps (such as the one for a UF2
+    // file, with one mapping per block) in any order. All the appended mappings are sorted and checked for overlaps
+    // in a single pass when the map is next used.
+    void append(const range& r, T t) {
+        if (r.to != r.from) {
+            assert(r.to > r.from);
+            if (!is_after_last(r)) {
+                sorted = false;
+            } else if (!entries.empty() && entries.back().to == r.from && entries.back().t + (T)entries.back().len() == t) {
+                entries.back().to = r.to;
+                return;
             }
-            m.insert(std::make_pair(r.from, std::make_pair(r.to, t)));
+            entries.push_back(entry{r.from, r.to, t});
         }
     }
 
@@ -323,81 +379,129 @@ template <typename T> struct range_map {
         if (r.to != r.from) {
             assert(r.to > r.from);
             // insert overlapping entry, and overwrite any it overlaps
-
-            // avoid modifying m while iterating through it
-            vector<uint32_t> to_erase;
-            vector<pair<uint32_t, pair<uint32_t, T>>> to_add;
-
-            auto f = m.upper_bound(r.from); // first element that starts after r.from
-            if (f != m.begin()) f--; // back up, to catch element that starts on or before r.from
-            for(; f != m.end() && f->first < r.to; f++) { // loop till we can't possibly overlap
-                range r2(f->first, f->second.first);
-                T r2off = f->second.second;
-                if (r2.intersects(r)) {
-                    // remove existing r2
-                    to_erase.push_back(r2.from);
-                    if (r2.from < r.from) {
-                        // add r2 which ends at start of r
-                        to_add.push_back(std::make_pair(r2.from, std::make_pair(r.from, r2off)));
-                    }
-                    if (r2.to > r.to) {
-                        // add r2 which starts at end of r
-                        to_add.push_back(std::make_pair(r.to, std::make_pair(r2.to, r2off + (r.to - r2.from))));
-                    }
-                }
+            normalize();
+            auto first = first_ending_after(r.from);
+            auto last = first;
+            while (last != entries.end() && last->from < r.to) last++;
+            vector<entry> replacement;
+            if (first != last && first->from < r.from) {
+                // keep the part of the first overlapped entry before r
+                replacement.push_back(entry{first->from, r.from, first->t});
+            }
+            replacement.push_back(entry{r.from, r.to, t});
+            if (first != last && (last - 1)->to > r.to) {
+                // keep the part of the last overlapped entry after r
+                const entry &e = *(last - 1);
+                replacement.push_back(entry{r.to, e.to, e.t + (T)(r.to - e.from)});
             }
-            for (auto k : to_erase) m.erase(k);
-            for (auto v : to_add) m.insert(v);
+            auto pos = entries.erase(first, last);
+            entries.insert(pos, replacement.begin(), replacement.end());
+        }
+    }
 
-            // finally, add the new entry
-            m.insert(std::make_pair(r.from, std::make_pair(r.to, t)));
+    // Look up p without throwing, for use where unmapped addresses are expected. Returns false if p isn't mapped, in
+    // which case the mapping covers the gap up to the next mapped address (or the end of the address space), and
+    // the value is default constructed
+    pair<bool, pair<mapping, T>> lookup(uint32_t p) {
+        normalize();
+        auto f = first_ending_after(p);
+        if (f == entries.end() || p < f->from) {
+            uint32_t next = f == entries.end() ? std::numeric_limits<uint32_t>::max() : f->from;
+            return std::make_pair(false, std::make_pair(mapping(0, next - p), T()));
         }
+        return std::make_pair(true, std::make_pair(mapping(p - f->from, f->to - f->from), f->t));
     }
 
     pair<mapping, T> get(uint32_t p) {
-        auto f = m.upper_bound(p);
-        if (f == m.end()) {
-            if (m.empty())
-                throw not_mapped_exception(p);
-        } else if (f == m.begin()) {
+        auto result = lookup(p);
+        if (!result.first) {
             throw not_mapped_exception(p);
         }
-        f--;
-        assert(p >= f->first);
-        if (p >= f->second.first) {
-            throw not_mapped_exception(p);
-        }
-        return std::make_pair(mapping(p - f->first, f->second.first - f->first), f->second.second);
+        return result.second;
     }
 
-    uint32_t next(uint32_t p) {
-        auto f = m.upper_bound(p);
-        if (f == m.end()) {
-            return std::numeric_limits<uint32_t>::max();
-        }
-        return f->first;
+    bool overlaps(const range& r) {
+        normalize();
+        auto f = first_ending_after(r.from);
+        return f != entries.end() && f->from < r.to;
     }
 
     vector<range> ranges() {
+        normalize();
         vector<range> r;
-        r.reserve(m.size());
-        for(const auto &e : m) {
-            r.emplace_back(range(e.first, e.second.first));
+        r.reserve(entries.size());
+        for(const auto &e : entries) {
+            r.emplace_back(range(e.from, e.to));
         }
         return r;
     }
 
-    size_t size() const { return m.size(); }
+    size_t size() const {
+        normalize();
+        return entries.size();
+    }
 
     range_map<T> offset_by(uint32_t offset) {
+        normalize();
         range_map<T> rmap_offset;
-        for(const auto &e : m) {
-            rmap_offset.insert(range(e.first + offset, e.second.first + offset), e.second.second);
+        for(const auto &e : entries) {
+            rmap_offset.append(range(e.from + offset, e.to + offset), e.t);
         }
+        rmap_offset.normalize();
         return rmap_offset;
     }
 private:
-    map<uint32_t, pair<uint32_t, T>> m;
+    struct entry {
+        uint32_t from;
+        uint32_t to;
+        T t;
+        uint32_t len() const { return to - from; }
+    };
+
+    bool is_after_last(const range &r) const {
+        return sorted && (entries.empty() || r.from >= entries.back().to);
+    }
+
+    // first entry which ends after p, i.e. the one containing p, or else the first one after it
+    typename vector<entry>::iterator first_ending_after(uint32_t p) {
+        return std::upper_bound(entries.begin(), entries.end(), p, [](uint32_t a, const entry &e) {
+            return a < e.to;
+        });
+    }
+
+    // sort any appended entries, check for overlaps, and merge contiguous entries
+    void normalize() const {
+        if (sorted) return;
+        std::stable_sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+            return a.from < b.from;
+        });
+        vector<entry> merged;
+        merged.reserve(entries.size());
+        for (const auto &e : entries) {
+            if (!merged.empty()) {
+                entry &prev = merged.back();
+                if (e.from < prev.to) {
+                    fail_overlap(range(e.from, e.to), range(prev.from, prev.to));
+                }
+                if (e.from == prev.to && prev.t + (T)prev.len() == e.t) {
+                    prev.to = e.to;
+                    continue;
+                }
+            }
+            merged.push_back(e);
+        }
+        entries.swap(merged);
+        sorted = true;
+    }
+
+    static void fail_overlap(const range &r, const range &r2) {
+        fail(ERROR_FORMAT, "Found overlapping memory ranges 0x%08x->0x%08x and 0x%08x->%08x\n",
+             r.from, r.to, r2.from, r2.to);
+    }
+
+    // mutable, so that appended entries can be sorted when the map is first used
+    mutable vector<entry> entries;
+    mutable bool sorted = true;
 };
 
 
@@ -519,7 +623,7 @@ struct bdev_fs : public cli::value_base<bdev_fs> {
 struct cmd {
     explicit cmd(string name) : _name(std::move(name)) {}
     virtual ~cmd() = default;
-    enum device_support { none, one, zero_or_more };
+    enum device_support { none, one, zero_or_more, one_or_more };
     virtual group get_cli() = 0;
     virtual string get_doc() const = 0;
     virtual device_support get_device_support() { return one; }
@@ -623,10 +727,12 @@ struct _settings {
         bool no_overwrite_force = false;
         bool update = false;
         bool ignore_pt = false;
+        bool all_devices = false;
         int partition = -1;
     } load;
 
-    struct {
+    struct seal_settings {
+        bool batch = false;
         bool hash = false;
         bool sign = false;
         bool clear_sram = false;
@@ -654,6 +760,7 @@ struct _settings {
 
     struct {
         bool all = false;
+        bool keep_blank = false;
         bool verify = false;
     } save;
 
@@ -1066,7 +1173,10 @@ struct save_command : public cmd {
         return (
             (
                 option('p', "--program") % "Save the installed program only. This is the default" |
-                option('a', "--all").doc_non_optional(true).set(settings.save.all) % "Save all of flash memory" |
+                (
+                    option('a', "--all").doc_non_optional(true).set(settings.save.all) % "Save all of flash memory" &
+                        option("--keep-blank").set(settings.save.keep_blank) % "Also save erased flash sectors. By default these are left out of UF2 files, and are not read from the device if it can check for them itself"
+                ).min(0).doc_non_optional(true) |
                 (
                     option('r', "--range").set(settings.range_set) % "Save a range of memory. Note that UF2s always store complete 256 byte-aligned blocks of 256 bytes, and the range is expanded accordingly" &
                         hex("from").set(settings.from) % "The lower address bound in hex" &
@@ -1091,6 +1201,10 @@ struct load_command : public cmd {
     load_command() : cmd("load") {}
     bool execute(device_map &devices) override;
 
+    device_support get_device_support() override {
+        return settings.load.all_devices ? one_or_more : one;
+    }
+
     group get_cli() override {
         return (
             (
@@ -1103,7 +1217,8 @@ struct load_command : public cmd {
                 option('N', "--no-overwrite-unsafe").set(settings.load.no_overwrite_force) % "When writing flash data, do not overwrite an existing program in flash. If picotool cannot determine the size/presence of the program in flash, the load continues anyway" +
                 option('u', "--update").set(settings.load.update) % "Skip writing flash sectors that already contain identical data" +
                 option('v', "--verify").set(settings.load.verify) % "Verify the data was written correctly" +
-                option('x', "--execute").set(settings.load.execute) % "Perform a bootrom reboot to execute the downloaded file as a program after the load - either a flash update boot for binaries in flash, or a RAM image boot for other binaries "
+                option('x', "--execute").set(settings.load.execute) % "Perform a bootrom reboot to execute the downloaded file as a program after the load - either a flash update boot for binaries in flash, or a RAM image boot for other binaries " +
+                option("--all-devices").set(settings.load.all_devices) % "Load onto all connected RP-series devices in BOOTSEL mode at the same time, rather than requiring a single device to be targeted"
             ).min(0).doc_non_optional(true) % "Post load actions" +
             file_selection % "File to load from" +
             (
@@ -1158,6 +1273,7 @@ struct encrypt_command : public cmd {
         return (
             option("--quiet").set(settings.quiet) % "Don't print any output" +
             option("--verbose").set(settings.verbose) % "Print verbose output" +
+            option("--batch").set(settings.seal.batch) % "Encrypt each input/output pair in the JSON manifest <infile> in parallel, writing a JSON report of their hashes and signatures to <outfile>" +
             option("--embed").set(settings.encrypt.embed) % "Embed bootloader in output file" +
             option("--fast-rosc").set(settings.encrypt.fast_rosc) % "Use ~180MHz ROSC configuration for embedded bootloader" +
             option("--use-mbedtls").set(settings.encrypt.use_mbedtls) % "Use MbedTLS implementation of embedded bootloader (faster but less secure)" +
@@ -1198,6 +1314,7 @@ struct seal_command : public cmd {
         return (
             option("--quiet").set(settings.quiet) % "Don't print any output" +
             option("--verbose").set(settings.verbose) % "Print verbose output" +
+            option("--batch").set(settings.seal.batch) % "Seal each input/output pair in the JSON manifest <infile> in parallel, writing a JSON report of their hashes and signatures to <outfile>" +
             (
                 option("--hash").set(settings.seal.hash) % "Hash the file" +
                 option("--sign").set(settings.seal.sign) % "Sign the file" +
@@ -2151,6 +2268,12 @@ struct memory_access {
 
     virtual uint32_t get_binary_start() = 0;
 
+    // hint that the given ranges are about to be read, so that they can be fetched together up front
+    virtual void prefetch(const vector<range> &ranges) {}
+
+    // the size of the flash as reported by the flash itself, or 0 if that isn't known
+    virtual uint32_t get_flash_size() { return 0; }
+
     uint32_t read_int(uint32_t addr, bool zero_fill = false) {
         assert(!(addr & 3u));
         uint32_t rc;
@@ -2339,6 +2462,77 @@ static inline bool is_transfer_aligned(uint32_t addr, const model_t& model) {
     return t != invalid && !(t == flash && addr & (PAGE_SIZE-1));
 }
 
+// Split a sector aligned flash range into as few erase commands as possible. Each command is at most
+// FLASH_ERASE_MAX_COMMAND_SIZE, and split on a block boundary so the bootrom can use block erases within it.
+// If the flash doesn't support block erases, commands are kept smaller than a block, so the bootrom never uses them.
+static vector<range> plan_flash_erase(const range &r, bool block_erase) {
+    static_assert(FLASH_ERASE_MAX_COMMAND_SIZE >= FLASH_BLOCK_ERASE_SIZE, "");
+    assert(is_size_aligned(r.from, FLASH_SECTOR_ERASE_SIZE) && is_size_aligned(r.to, FLASH_SECTOR_ERASE_SIZE));
+    vector<range> erases;
+    for (uint32_t from = r.from; from < r.to;) {
+        uint32_t to = block_erase ? (from + FLASH_ERASE_MAX_COMMAND_SIZE) & ~(FLASH_BLOCK_ERASE_SIZE - 1) :
+                                    from + FLASH_BLOCK_ERASE_SIZE - FLASH_SECTOR_ERASE_SIZE;
+        to = std::min(r.to, to);
+        erases.emplace_back(from, to);
+        from = to;
+    }
+    return erases;
+}
+
+// Compress data to be expanded by the program exec'd by program_flash_compressed. The data is a sequence of tokens:
+// 0x00-0x7f is followed by that many plus one literal bytes, and 0x80-0xff copies that many minus 125 bytes (3 to 130)
+// from the distance back in the output given by the 16 bit little endian value after it. A copy may overlap what it
+// produces, so a run is a byte followed by a copy from distance 1. Matches are found greedily, via a hash of 3 bytes.
+static vector<uint8_t> compress_flash_data(const uint8_t *data, uint32_t len) {
+    const uint32_t min_match = 3;
+    const uint32_t max_match = 130;
+    const uint32_t max_literals = 128;
+    const uint32_t max_distance = 0xffff;
+    const unsigned int hash_bits = 14;
+    auto hash = [&](uint32_t pos) {
+        uint32_t v = data[pos] | data[pos + 1] << 8 | data[pos + 2] << 16;
+        return (v * 2654435761u) >> (32 - hash_bits);
+    };
+    vector<int64_t> last_pos(1u << hash_bits, -1);
+    vector<uint8_t> out;
+    uint32_t literals_from = 0;
+    auto add_literals = [&](uint32_t to) {
+        while (literals_from < to) {
+            uint32_t count = std::min(to - literals_from, max_literals);
+            out.push_back(count - 1);
+            out.insert(out.end(), data + literals_from, data + literals_from + count);
+            literals_from += count;
+        }
+    };
+    uint32_t pos = 0;
+    while (pos + min_match <= len) {
+        uint32_t h = hash(pos);
+        int64_t candidate = last_pos[h];
+        last_pos[h] = pos;
+        uint32_t match_len = 0;
+        if (candidate >= 0 && pos - candidate <= max_distance) {
+            uint32_t limit = std::min(max_match, len - pos);
+            while (match_len < limit && data[candidate + match_len] == data[pos + match_len]) match_len++;
+        }
+        if (match_len < min_match) {
+            pos++;
+            continue;
+        }
+        add_literals(pos);
+        uint32_t distance = pos - (uint32_t)candidate;
+        out.push_back(0x80 + match_len - min_match);
+        out.push_back(distance & 0xff);
+        out.push_back(distance >> 8);
+        for (uint32_t i = 1; i < match_len && pos + i + min_match <= len; i++) {
+            last_pos[hash(pos + i)] = pos + i;
+        }
+        pos += match_len;
+        literals_from = pos;
+    }
+    add_literals(len);
+    return out;
+}
+
 // this must be called after the right model is set on raw_access which is why it isn't
 // part of init_model
 static chip_revision_t determine_chip_revision(memory_access &raw_access) {
@@ -2382,11 +2576,236 @@ static chip_revision_t determine_chip_revision(memory_access &raw_access) {
     return chip_revision;
 }
 #if HAS_LIBUSB
+// Progress of one device during load --all-devices. Each device is loaded on its own thread, so progress bars and
+// other output on that thread are captured here rather than written to stdout
+struct device_load_status {
+    std::mutex mutex;
+    int percent = 0;
+    int bars_finished = 0;
+    bool done = false;
+    std::stringstream output;
+};
+static thread_local device_load_status *thread_load_status = nullptr;
+
+static std::ostream &load_output() {
+    return thread_load_status ? thread_load_status->output : std::cout;
+}
+
+struct partition_details;
+typedef tuple<resident_partition_t, std::shared_ptr<vector<partition_details>>> partition_info_t;
+
+// ROM pages read from a device. The ROM is the same on every device with a given chip revision, so once that is
+// known the snapshot is shared by all of them (see get_rom_snapshot), and lookups in the ROM tables need only the
+// reads to determine the model and revision. The mutex is recursive, as reading RP2040 ROM may itself need a lookup.
+struct rom_snapshot {
+    std::recursive_mutex mutex;
+    std::map<uint32_t, std::array<uint8_t, PAGE_SIZE>> pages;
+};
+
+// Get the snapshot shared by all devices of the same model and revision as model (which must be known), adding
+// any pages already read into from
+static std::shared_ptr<rom_snapshot> get_rom_snapshot(const model_t &model, const rom_snapshot &from) {
+    static std::map<std::tuple<chip_t, chip_revision_t, uint32_t>, std::shared_ptr<rom_snapshot>> rom_snapshots;
+    static std::mutex rom_snapshots_mutex;
+    assert(model->chip_revision() != unknown_revision);
+    std::shared_ptr<rom_snapshot> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(rom_snapshots_mutex);
+        auto &shared = rom_snapshots[std::make_tuple(model->chip(), model->chip_revision(), model->rom_end())];
+        if (!shared) shared = std::make_shared<rom_snapshot>();
+        snapshot = shared;
+    }
+    std::lock_guard<std::recursive_mutex> lock(snapshot->mutex);
+    snapshot->pages.insert(from.pages.cbegin(), from.pages.cend());
+    return snapshot;
+}
+
+// The geometry of the flash as reported by the flash itself, from its JEDEC ID and SFDP tables
+struct flash_geometry {
+    uint32_t jedec_id = 0;
+    // 0 if not known
+    uint32_t size = 0;
+    // all the erase sizes supported (these are powers of two), or 0 if not known
+    uint32_t erase_sizes = 0;
+};
+
+// What we know about the device on an open connection, so that it is only fetched once however many memory
+// accesses are made: the model (and revision), ROM contents, flash ID and geometry, and partition table. Flash writes
+// and erases must call flash_changed, as the partition table may no longer be valid.
+struct device_profile {
+    void flash_changed() {
+        has_partition_info = false;
+        partition_info = nullptr;
+    }
+
+    model_t model;
+    std::shared_ptr<rom_snapshot> rom = std::make_shared<rom_snapshot>();
+    bool has_flash_id = false;
+    uint64_t flash_id = 0;
+    bool has_flash_geometry = false;
+    flash_geometry geometry;
+    bool has_partition_info = false;
+    std::shared_ptr<partition_info_t> partition_info;
+};
+
+// profiles are kept until the device handle is closed; each handle is only used from one thread at a time,
+// but devices may be used from different threads
+static std::map<libusb_device_handle *, std::shared_ptr<device_profile>> device_profiles;
+static std::mutex device_profiles_mutex;
+
+static std::shared_ptr<device_profile> get_device_profile(picoboot::connection &connection) {
+    std::lock_guard<std::mutex> lock(device_profiles_mutex);
+    auto &profile = device_profiles[connection.get_device()];
+    if (!profile) profile = std::make_shared<device_profile>();
+    return profile;
+}
+
+static uint64_t get_flash_id(picoboot::connection &connection) {
+    auto profile = get_device_profile(connection);
+    if (!profile->has_flash_id) {
+        connection.flash_id(profile->flash_id);
+        profile->has_flash_id = true;
+    }
+    return profile->flash_id;
+}
+
+// Ask the flash for its JEDEC ID and the SFDP Basic Flash Parameter Table, for the size and erase sizes. This runs a
+// program from XIP SRAM (overwriting its contents), so is only done on RP2040; anything which can't be found is left
+// unknown.
+static flash_geometry probe_flash_geometry(picoboot::connection &connection) {
+    flash_geometry geometry;
+    const uint32_t program_base = XIP_SRAM_START_RP2040;
+    // program is "for each command { select the flash; for each byte { send it, and replace it with the byte received }
+    // deselect the flash }" followed by its parameters: SSI base, QSPI SS control register, then each command as a
+    // word length and its bytes (padded to a word), ending with a length of 0; so both commands take a single exec
+    const std::vector<uint32_t> program = {
+                0xa40db510, // push  {r4, lr};              adr   r4, params
+                0xcc02cc0c, // ldmia r4!, {r2, r3};         cmd_loop: ldmia r4!, {r1}
+                0xd0132900, // cmp   r1, #0;                beq   done
+                0x02002002, // movs  r0, #2;                lsls  r0, r0, #8
+                0x78206018, // str   r0, [r3];              byte_loop: ldrb r0, [r4]
+                0x6a906610, // str   r0, [r2, #96];         rx_wait: ldr r0, [r2, #40]
+                0xd5fc0700, // lsls  r0, r0, #28;           bpl   rx_wait
+                0x70206e10, // ldr   r0, [r2, #96];         strb  r0, [r4]
+                0x39013401, // adds  r4, #1;                subs  r1, #1
+                0x2003d1f5, // bne   byte_loop;             movs  r0, #3
+                0x60180200, // lsls  r0, r0, #8;            str   r0, [r3]
+                0x08a43403, // adds  r4, #3;                lsrs  r4, r4, #2
+                0xe7e800a4, // lsls  r4, r4, #2;            b     cmd_loop
+                0x46c0bd10, // done: pop {r4, pc};          nop
+        };
+    // the SFDP read has a 24-bit address (of 0) and a dummy byte before the data
+    const uint32_t sfdp_header_len = 5;
+    vector<vector<uint8_t>> cmds = {
+        {FLASH_JEDEC_ID_CMD, 0, 0, 0},
+        vector<uint8_t>(sfdp_header_len + SFDP_READ_LEN),
+    };
+    cmds[1][0] = FLASH_READ_SFDP_CMD;
+    vector<uint8_t> image((const uint8_t *)program.data(), (const uint8_t *)(program.data() + program.size()));
+    auto put_le32 = [&](uint32_t v) {
+        for (int i = 0; i < 4; i++) image.push_back(v >> (i * 8));
+    };
+    put_le32(XIP_SSI_BASE_RP2040);
+    put_le32(IO_QSPI_BASE_RP2040 + 0x0c); // GPIO_QSPI_SS_CTRL
+    vector<size_t> cmd_offsets;
+    for (const auto &cmd : cmds) {
+        put_le32(cmd.size());
+        cmd_offsets.push_back(image.size());
+        image.insert(image.end(), cmd.cbegin(), cmd.cend());
+        image.resize((image.size() + 3) & ~3u);
+    }
+    put_le32(0);
+    try {
+        connection.exit_xip();
+        connection.write(program_base, image.data(), image.size());
+        connection.exec(program_base);
+        connection.read(program_base, image.data(), image.size());
+    } catch (picoboot::command_failure &e) {
+        DEBUG_LOG("Flash geometry probe failed (%s)\n", e.what());
+        return geometry;
+    }
+    auto le32 = [](const uint8_t *p) {
+        return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    };
+    const uint8_t *id = image.data() + cmd_offsets[0] + 1;
+    geometry.jedec_id = id[0] << 16 | id[1] << 8 | id[2];
+    // SFDP header, followed by the first parameter header, which must be for the Basic Flash Parameter Table
+    const uint8_t *sfdp = image.data() + cmd_offsets[1] + sfdp_header_len;
+    const uint8_t *header = sfdp;
+    if (le32(header) != SFDP_SIGNATURE || header[8] != 0 || header[15] != 0xff) {
+        DEBUG_LOG("Flash %06x has no SFDP Basic Flash Parameter Table\n", geometry.jedec_id);
+        return geometry;
+    }
+    uint32_t bfpt_addr = header[12] | header[13] << 8 | header[14] << 16;
+    // dwords 8 and 9 are only needed if the table has them
+    uint32_t bfpt_len = (header[11] >= SFDP_BFPT_MIN_DWORDS ? SFDP_BFPT_MIN_DWORDS : 2) * 4;
+    if (bfpt_addr + bfpt_len > SFDP_READ_LEN) {
+        DEBUG_LOG("Flash %06x SFDP Basic Flash Parameter Table at %06x wasn't read\n", geometry.jedec_id, bfpt_addr);
+        return geometry;
+    }
+    const uint8_t *bfpt = sfdp + bfpt_addr;
+    // the density is either the size in bits minus one, or the log2 of the size in bits
+    uint32_t density = le32(bfpt + 4);
+    if (!(density & 0x80000000u)) {
+        geometry.size = (density + 1) / 8;
+    } else {
+        uint32_t log2_bits = density & 0x7fffffffu;
+        if (log2_bits >= 3 && log2_bits < 35) geometry.size = 1u << (log2_bits - 3);
+    }
+    if ((bfpt[0] & 3) == 1) geometry.erase_sizes |= FLASH_SECTOR_ERASE_SIZE;
+    if (header[11] >= SFDP_BFPT_MIN_DWORDS) {
+        // dwords 8 and 9 list up to 4 erase types, each a size (as a power of two) and an instruction
+        const uint8_t *erase_types = bfpt + 7 * 4;
+        for (int i = 0; i < 4; i++) {
+            uint8_t log2_size = erase_types[i * 2];
+            if (log2_size && log2_size < 32) geometry.erase_sizes |= 1u << log2_size;
+        }
+    }
+    DEBUG_LOG("Flash %06x size %08x erase sizes %08x\n", geometry.jedec_id, geometry.size, geometry.erase_sizes);
+    return geometry;
+}
+
+static const flash_geometry &get_flash_geometry(picoboot::connection &connection) {
+    static const flash_geometry unknown_geometry;
+    auto profile = get_device_profile(connection);
+    if (!profile->has_flash_geometry) {
+        // the probe exits XIP, which mustn't be done under anything else using the device
+        if (!connection.is_exclusive()) return unknown_geometry;
+        profile->geometry = probe_flash_geometry(connection);
+        profile->has_flash_geometry = true;
+    }
+    return profile->geometry;
+}
+
+static void close_device(libusb_device_handle *handle) {
+    {
+        std::lock_guard<std::mutex> lock(device_profiles_mutex);
+        device_profiles.erase(handle);
+    }
+    picoboot_close_device(handle);
+}
+
 struct picoboot_memory_access : public memory_access {
-    explicit picoboot_memory_access(picoboot::connection &connection) : connection(connection) {
+    explicit picoboot_memory_access(picoboot::connection &connection) : connection(connection),
+                                                                        profile(get_device_profile(connection)) {
+        if (profile->model) {
+            model = profile->model;
+            return;
+        }
         model = determine_model(*this);
         if (model->chip() != unknown)
             model->set_chip_revision(determine_chip_revision(*this));
+        profile->model = model;
+        if (model->chip_revision() != unknown_revision) {
+            profile->rom = get_rom_snapshot(model, *profile->rom);
+        }
+    }
+
+    ~picoboot_memory_access() {
+        if (flash_cache_hits || flash_cache_misses) {
+            // this may be on a load --all-devices thread
+            if (settings.verbose) load_output() << "Flash cache: " << flash_cache_hits << " page hits, " << flash_cache_misses << " page misses\n";
+        }
     }
 
     bool is_device() override {
@@ -2400,6 +2819,8 @@ struct picoboot_memory_access : public memory_access {
     void read(uint32_t address, uint8_t *buffer, unsigned int size, __unused bool zero_fill) override {
         if (settings.use_flash_cache && flash == get_memory_type(address, model)) {
             read_cached(address, buffer, size);
+        } else if (is_rom_cached(address, size)) {
+            read_rom_cached(address, buffer, size);
         } else {
             read_raw(address, buffer, size);
         }
@@ -2409,62 +2830,120 @@ struct picoboot_memory_access : public memory_access {
         flash_cache.clear();
     }
 
-    void read_cached(uint32_t address, uint8_t *buffer, unsigned int size) {
-        for (auto range: flash_cache) {
-            uint32_t cached_start = std::get<0>(range);
-            uint32_t cached_size = std::get<1>(range);
-            auto cached_data = std::get<2>(range);
-            if (address >= cached_start) {
-                if (address >= cached_start + cached_size) {
-                    // No data already cached
-                    continue;
-                } else if (address + size <= cached_start + cached_size) {
-                    // All data already cached
-                    DEBUG_LOG("Flash Cache Hit %08x+%08x\n", address, size);
-                    std::copy(cached_data.cbegin() + (address - cached_start), cached_data.cbegin() + (address + size - cached_start), buffer);
-                    return;
+    uint32_t get_flash_size() override {
+        if (model->chip() != rp2040 || !(enable_flash_probe || profile->has_flash_geometry)) return 0;
+        return std::min(get_flash_geometry(connection).size, model->flash_end() - FLASH_START);
+    }
+
+    // whether the bootrom may use block erases, which is only not the case once the flash has said it doesn't
+    // support them; this doesn't probe the flash, as that would overwrite XIP SRAM
+    bool can_block_erase() {
+        return !profile->has_flash_geometry || !profile->geometry.erase_sizes ||
+               (profile->geometry.erase_sizes & FLASH_BLOCK_ERASE_SIZE);
+    }
+
+    // called before anything changes the flash other than through write
+    void flash_changed() {
+        clear_cache();
+        profile->flash_changed();
+    }
+
+    // ROM reads (mostly the ROM table walks) are cached in the device profile like flash reads, as the ROM can't
+    // change. On RP2040, reads which end just before RP2040_ROM_DIRECT_READ_END aren't cached, as filling their
+    // last page would mean copying the ROM on the device, which they otherwise wouldn't do.
+    bool is_rom_cached(uint32_t address, unsigned int size) {
+        if (address >= model->rom_end() || size > model->rom_end() - address) return false;
+        return model->chip() != rp2040 || address + size <= RP2040_ROM_DIRECT_READ_END - PAGE_SIZE ||
+               address + size >= RP2040_ROM_DIRECT_READ_END;
+    }
+
+    void read_rom_cached(uint32_t address, uint8_t *buffer, unsigned int size) {
+        auto rom = profile->rom;
+        std::lock_guard<std::recursive_mutex> lock(rom->mutex);
+        uint32_t end = address + size;
+        while (address < end) {
+            uint32_t page = address & ~(PAGE_SIZE - 1);
+            auto it = rom->pages.find(page);
+            if (it == rom->pages.end()) {
+                if (model->chip() == rp2040 && end >= RP2040_ROM_DIRECT_READ_END) {
+                    // this copies the whole ROM on the device (see read_raw), so keep all of it
+                    fill_rom_cache(0, model->rom_end());
                 } else {
-                    // Start of data already cached, but end needs reading
-                    uint32_t cached_used_size = cached_size - (address - cached_start);
-                    DEBUG_LOG("Flash Cache Hit Start %08x+%08x\n", address, cached_used_size);
-                    std::copy(cached_data.cbegin() + (address - cached_start), cached_data.cbegin() + cached_size, buffer);
-                    size -= cached_used_size;
-                    address += cached_used_size;
-                    buffer += cached_used_size;
+                    uint32_t miss_end = std::max(end, page + ROM_READ_AHEAD_SIZE);
+                    miss_end = std::min((miss_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1), model->rom_end());
+                    if (model->chip() == rp2040) {
+                        // don't read ahead far enough to need the ROM to be copied
+                        miss_end = std::min(miss_end, RP2040_ROM_DIRECT_READ_END - PAGE_SIZE);
+                    } else if (end <= model->unreadable_rom_start()) {
+                        // don't read ahead into ROM which can't be read from the device
+                        miss_end = std::min(miss_end, std::max(model->unreadable_rom_start() & ~(PAGE_SIZE - 1), page + PAGE_SIZE));
+                    }
+                    auto next = rom->pages.lower_bound(page);
+                    if (next != rom->pages.end()) miss_end = std::min(miss_end, next->first);
+                    fill_rom_cache(page, miss_end);
                 }
+                it = rom->pages.find(page);
+            }
+            uint32_t this_size = std::min(end, page + PAGE_SIZE) - address;
+            std::copy(it->second.cbegin() + (address - page), it->second.cbegin() + (address - page + this_size), buffer);
+            address += this_size;
+            buffer += this_size;
+        }
+    }
+
+    // Flash reads are cached in PAGE_SIZE pages, and any run of missing pages is fetched with a single read; small
+    // reads are extended to FLASH_READ_AHEAD_SIZE, as nearby data is usually wanted next
+    void read_cached(uint32_t address, uint8_t *buffer, unsigned int size) {
+        uint32_t end = address + size;
+        while (address < end) {
+            uint32_t page = address & ~(PAGE_SIZE - 1);
+            auto it = flash_cache.lower_bound(page);
+            if (it == flash_cache.end() || it->first != page) {
+                // read all the missing pages up to the next cached one
+                uint32_t miss_end = std::max(end, page + FLASH_READ_AHEAD_SIZE);
+                miss_end = std::min((miss_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1), model->flash_end());
+                if (it != flash_cache.end()) miss_end = std::min(miss_end, it->first);
+                fill_cache(page, miss_end);
+                it = flash_cache.find(page);
             } else {
-                if (address + size <= cached_start) {
-                    // No data already cached
-                    continue;
-                } else if (address + size <= cached_start + cached_size) {
-                    DEBUG_LOG("Flash Cache Hit End %08x+%08x\n", cached_start, (address + size - cached_start));
-                    // End of data already cached, but start needs reading
-                    std::copy(cached_data.cbegin(), cached_data.cbegin() + (address + size - cached_start), buffer + (cached_start - address));
-                    size = cached_start - address;
-                } else {
-                    // Middle of data already cached, start and end needs reading
-                    uint32_t split_size = cached_start - address; // split into address->cached_start and cached_start->(address + size)
-                    DEBUG_LOG("Flash Cache Hit Middle %08x+%08x\n", cached_start, cached_size);
-                    // Read data before
-                    read_cached(address, buffer, split_size);
-                    // Read rest
-                    read_cached(address + split_size, buffer + split_size, size - split_size);
-                    return;
-                }
+                flash_cache_hits++;
             }
+            uint32_t this_size = std::min(end, page + PAGE_SIZE) - address;
+            std::copy(it->second.cbegin() + (address - page), it->second.cbegin() + (address - page + this_size), buffer);
+            address += this_size;
+            buffer += this_size;
         }
+    }
 
-        DEBUG_LOG("Flash Caching %08x+%08x\n", address, size);
-        read_raw(address, buffer, size);
-        std::vector<uint8_t> cached_data(buffer, buffer + size);
-        flash_cache.push_back(std::make_tuple(address, size, cached_data));
+    // Fetch the flash pages covering all the ranges into the cache, using as few reads as possible; missing pages
+    // less than FLASH_PREFETCH_MAX_GAP apart are read together, as that is quicker than another round trip
+    void prefetch(const vector<range> &ranges) override {
+        if (!settings.use_flash_cache) return;
+        vector<uint32_t> pages;
+        for (const auto &r : ranges) {
+            if (r.empty() || flash != get_memory_type(r.from, model)) continue;
+            uint32_t to = std::min(r.to, model->flash_end());
+            for (uint32_t page = r.from & ~(PAGE_SIZE - 1); page < to; page += PAGE_SIZE) {
+                if (!flash_cache.count(page)) pages.push_back(page);
+            }
+        }
+        std::sort(pages.begin(), pages.end());
+        auto it = pages.cbegin();
+        while (it != pages.cend()) {
+            uint32_t from = *it;
+            uint32_t to = from + PAGE_SIZE;
+            for (it++; it != pages.cend() && *it <= to + FLASH_PREFETCH_MAX_GAP; it++) {
+                to = std::max(to, *it + PAGE_SIZE);
+            }
+            fill_cache(from, to);
+        }
     }
 
     void read_raw(uint32_t address, uint8_t *buffer, unsigned int size) {
         if (flash == get_memory_type(address, model)) {
             connection.exit_xip();
         }
-        if (model->chip() == rp2040 && rom == get_memory_type(address, model) && (address+size) >= 0x2000) {
+        if (model->chip() == rp2040 && rom == get_memory_type(address, model) && (address+size) >= RP2040_ROM_DIRECT_READ_END) {
             // read by memcpy instead
             unsigned int program_base = SRAM_START + 0x4000;
             // program is "return memcpy(SRAM_BASE, 0, 0x4000);"
@@ -2513,56 +2992,391 @@ struct picoboot_memory_access : public memory_access {
         }
     }
 
+    // Calculate the CRC32 (crc32_sw with an initial value of 0xffffffff) of each of count consecutive flash sectors
+    // starting at address on the device itself, so verification only needs to transfer 4 bytes per sector rather
+    // than the data. This runs a small program from XIP SRAM (overwriting its contents), so is only done on RP2040
+    // when enable_device_crcs is set. read_flash_crcs returns false if the CRCs were not calculated. The first time, one
+    // sector is also read back and its CRC compared, and if that doesn't match device CRCs aren't used again.
+    bool can_read_flash_crcs(uint32_t address, uint32_t size) {
+        return enable_device_crcs && model->chip() == rp2040 && model->supports_picoboot_cmd(PC_EXEC) &&
+               flash == get_memory_type(address, model) && flash == get_memory_type(address + size - 1, model);
+    }
+
+    bool read_flash_crcs(uint32_t address, uint32_t count, vector<uint32_t> &crcs) {
+        if (!can_read_flash_crcs(address, count * FLASH_SECTOR_ERASE_SIZE)) {
+            return false;
+        }
+        const uint32_t program_base = XIP_SRAM_START_RP2040;
+        // limit the sectors per exec, as the device doesn't respond to USB until the program returns
+        const uint32_t max_sectors_per_exec = 64;
+        // program is "for each sector { crc = ~0; for each word { crc ^= rev(word); 4 times crc = (crc << 8) ^ table[crc >> 24]; }
+        // *results++ = crc; }" followed by its parameters: flash address, sector count, table address, sector size, results
+        // address. The flash is read a word at a time, as each uncached XIP access is a separate QSPI transfer
+        const std::vector<uint32_t> program = {
+                0xa712b5f0, // push {r4, r5, r6, r7, lr};   adr   r7, params
+                0xb420cf6b, // ldmia r7!, {r0, r1, r3, r5, r6};   push {r5}
+                0x43e42400, // sector_loop: movs r4, #0;    mvns  r4, r4
+                0x19459d00, // ldr   r5, [sp, #0];          adds  r5, r0, r5
+                0xba12c804, // word_loop: ldmia r0!, {r2};  rev   r2, r2
+                0x0e274054, // eors  r4, r2;                lsrs  r7, r4, #24
+                0x59df00bf, // lsls  r7, r7, #2;            ldr   r7, [r3, r7]
+                0x407c0224, // lsls  r4, r4, #8;            eors  r4, r7
+                0x00bf0e27, // lsrs  r7, r4, #24;           lsls  r7, r7, #2
+                0x022459df, // ldr   r7, [r3, r7];          lsls  r4, r4, #8
+                0x0e27407c, // eors  r4, r7;                lsrs  r7, r4, #24
+                0x59df00bf, // lsls  r7, r7, #2;            ldr   r7, [r3, r7]
+                0x407c0224, // lsls  r4, r4, #8;            eors  r4, r7
+                0x00bf0e27, // lsrs  r7, r4, #24;           lsls  r7, r7, #2
+                0x022459df, // ldr   r7, [r3, r7];          lsls  r4, r4, #8
+                0x42a8407c, // eors  r4, r7;                cmp   r0, r5
+                0xc610d1e6, // bne   word_loop;             stmia r6!, {r4}
+                0xd1df3901, // subs  r1, #1;                bne   sector_loop
+                0xbdf0b001, // add   sp, #4;                pop   {r4, r5, r6, r7, pc}
+        };
+        const uint32_t num_params = 5;
+        const uint32_t table_base = program_base + (program.size() + num_params) * sizeof(uint32_t);
+        const uint32_t results_base = table_base + 0x100 * sizeof(uint32_t);
+        vector<uint32_t> table(0x100);
+        for (unsigned int i = 0; i < table.size(); i++) {
+            uint8_t byte = i;
+            table[i] = crc32_sw(&byte, 1, 0);
+        }
+        crcs.clear();
+        try {
+            vector<uint32_t> image = program;
+            image.resize(program.size() + num_params);
+            image.insert(image.end(), table.begin(), table.end());
+            bool loaded = false;
+            while (count) {
+                uint32_t this_count = std::min(count, max_sectors_per_exec);
+                uint32_t *params = image.data() + program.size();
+                params[0] = address - FLASH_START + XIP_NOCACHE_NOALLOC_BASE_RP2040; // don't use (or disturb) the XIP cache
+                params[1] = this_count;
+                params[2] = table_base;
+                params[3] = FLASH_SECTOR_ERASE_SIZE;
+                params[4] = results_base;
+                if (!loaded) {
+                    write_vector(program_base, image);
+                    loaded = true;
+                } else {
+                    write_vector(program_base + program.size() * sizeof(uint32_t), vector<uint32_t>(params, params + num_params));
+                }
+                // the program reads the flash via XIP
+                connection.enter_cmd_xip();
+                connection.exec(program_base);
+                vector<uint32_t> results(this_count);
+                connection.read(results_base, (uint8_t *) results.data(), this_count * sizeof(uint32_t));
+                if (!device_crcs_checked) {
+                    // check the first result against a CRC of the sector read back, as a wrong CRC could hide a mismatch
+                    vector<uint8_t> sector(FLASH_SECTOR_ERASE_SIZE);
+                    read_raw(address, sector.data(), sector.size());
+                    if (crc32_sw(sector.data(), sector.size(), 0xffffffff) != results[0]) {
+                        DEBUG_LOG("Device CRC calculation gave the wrong result, falling back to reading back the data\n");
+                        enable_device_crcs = false;
+                        crcs.clear();
+                        return false;
+                    }
+                    device_crcs_checked = true;
+                }
+                crcs.insert(crcs.end(), results.begin(), results.end());
+                address += this_count * FLASH_SECTOR_ERASE_SIZE;
+                count -= this_count;
+            }
+        } catch (picoboot::command_failure &e) {
+            DEBUG_LOG("Device CRC calculation failed (%s), falling back to reading back the data\n", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    // Check which of count consecutive flash sectors starting at address are erased (all 0xff) on the device itself,
+    // so blank sectors needn't be transferred. Like read_flash_crcs this runs a small program from XIP SRAM, and
+    // returns false if the check was not done.
+    bool read_flash_blank(uint32_t address, uint32_t count, vector<bool> &blank) {
+        if (!can_read_flash_crcs(address, count * FLASH_SECTOR_ERASE_SIZE)) {
+            return false;
+        }
+        const uint32_t program_base = XIP_SRAM_START_RP2040;
+        const uint32_t max_sectors_per_exec = 64;
+        // program is "for each sector { *results++ = all words in sector == 0xffffffff; }"
+        // followed by its parameters: flash address, sector count, sector size, results address
+        const std::vector<uint32_t> program = {
+                0xa708b5f0, // push {r4, r5, r6, r7, lr};   adr   r7, params
+                0x18c5cf4b, // ldmia r7!, {r0, r1, r3, r6}; sector_loop: adds r5, r0, r3
+                0xc8842400, // movs  r4, #0;                word_loop: ldmia r0!, {r2, r7}
+                0x3201403a, // ands  r2, r7;                adds  r2, #1
+                0x42a8d102, // bne   next_sector;           cmp   r0, r5
+                0x2401d1f9, // bne   word_loop;             movs  r4, #1
+                0xc6100028, // next_sector: movs r0, r5;    stmia r6!, {r4}
+                0xd1f23901, // subs  r1, #1;                bne   sector_loop
+                0x46c0bdf0, // pop   {r4, r5, r6, r7, pc};  nop
+        };
+        const uint32_t num_params = 4;
+        const uint32_t results_base = program_base + (program.size() + num_params) * sizeof(uint32_t);
+        blank.clear();
+        try {
+            vector<uint32_t> image = program;
+            image.resize(program.size() + num_params);
+            bool loaded = false;
+            while (count) {
+                uint32_t this_count = std::min(count, max_sectors_per_exec);
+                uint32_t *params = image.data() + program.size();
+                params[0] = address - FLASH_START + XIP_NOCACHE_NOALLOC_BASE_RP2040; // don't use (or disturb) the XIP cache
+                params[1] = this_count;
+                params[2] = FLASH_SECTOR_ERASE_SIZE;
+                params[3] = results_base;
+                if (!loaded) {
+                    write_vector(program_base, image);
+                    loaded = true;
+                } else {
+                    write_vector(program_base + program.size() * sizeof(uint32_t), vector<uint32_t>(params, params + num_params));
+                }
+                // the program reads the flash via XIP
+                connection.enter_cmd_xip();
+                connection.exec(program_base);
+                vector<uint32_t> results(this_count);
+                connection.read(results_base, (uint8_t *) results.data(), this_count * sizeof(uint32_t));
+                for (auto r : results) blank.push_back(r != 0);
+                address += this_count * FLASH_SECTOR_ERASE_SIZE;
+                count -= this_count;
+            }
+        } catch (picoboot::command_failure &e) {
+            DEBUG_LOG("Device blank check failed (%s), falling back to reading the data\n", e.what());
+            blank.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // Whether program_flash_compressed can be used; it runs a program from SRAM (overwriting its contents), so is only
+    // done on RP2040 when enable_compressed_flash is set
+    bool can_program_flash_compressed() {
+        return enable_compressed_flash && model->chip() == rp2040 && model->supports_picoboot_cmd(PC_EXEC);
+    }
+
+    // Erase and program len bytes of flash at address (whole sectors within one FLASH_COMPRESSED_BATCH_SIZE block)
+    // with data, sending the data compressed (see compress_flash_data). A small program in SRAM expands it, then erases
+    // the sectors and programs the pages which aren't all 0xff using the bootrom's flash functions. The commands are
+    // queued, adding the number queued to num_cmds, and what they send is kept in images. Returns false, having done
+    // nothing, if the data doesn't compress well enough to be worth it, or the device won't run the program; the
+    // bootrom commands should be used instead.
+    //
+    // The device can't receive over USB while the program runs, so if next_len is given (the caller will program the
+    // next_len bytes following this block with the next call) the program starts erasing the start of them before it
+    // returns, and the next program waits for that to finish. The erase then overlaps sending the next block. The flash
+    // is otherwise left in the same state as after the bootrom's erase and write commands.
+    bool program_flash_compressed(uint32_t address, const uint8_t *data, uint32_t len, uint32_t next_len,
+                                  std::deque<vector<uint8_t>> &images, unsigned int &num_cmds) {
+        if (!can_program_flash_compressed()) {
+            return false;
+        }
+        assert(is_size_aligned(address, FLASH_SECTOR_ERASE_SIZE) && is_size_aligned(len, FLASH_SECTOR_ERASE_SIZE));
+        assert(len && len <= FLASH_COMPRESSED_BATCH_SIZE &&
+               address / FLASH_COMPRESSED_BATCH_SIZE == (address + len - 1) / FLASH_COMPRESSED_BATCH_SIZE);
+        // the erase started by the previous program must be for this block
+        assert(!erase_started_size || (erase_started_address == address && erase_started_size <= len));
+        const uint32_t program_base = SRAM_START;
+        // the data is expanded to here, after the program, its parameters and the compressed data
+        const uint32_t output_base = SRAM_START + 0x20000;
+        // program is "expand the data to output; connect_internal_flash(); flash_exit_xip();
+        // if (erased) wait until the flash isn't busy; if (size > erased) flash_range_erase(offset + erased, size - erased,
+        // block_size, block_cmd); for each page { if any word != ~0 flash_range_program(...); }
+        // if (next_erase) { send write enable; send next_erase; }" with the flash commands sent directly through the SSI,
+        // followed by its parameters: compressed data start and end, flash offset, erase block size and command, output
+        // address, the addresses of those bootrom functions, the number of bytes already being erased, the erase command
+        // and address (as bytes) to start for the next block or 0, the SSI and chip select control register addresses,
+        // and the write enable and read status command bytes
+        const std::vector<uint32_t> program = {
+                0xa73bb5f0, // push  {r4, r5, r6, r7, lr};  adr   r7, params
+                0x68796838, // ldr   r0, [r7, #0];          ldr   r1, [r7, #4]
+                0x4288697a, // ldr   r2, [r7, #20];         token_loop: cmp r0, r1
+                0x7803d219, // bhs   expanded;              ldrb  r3, [r0]
+                0x2b7f3001, // adds  r0, #1;                cmp   r3, #127
+                0x3301d807, // bhi   match;                 adds  r3, #1
+                0x30017804, // literal_loop: ldrb r4, [r0]; adds  r0, #1
+                0x32017014, // strb  r4, [r2];              adds  r2, #1
+                0xd1f93b01, // subs  r3, #1;                bne   literal_loop
+                0x3b7de7f1, // b     token_loop;            match: subs r3, #125
+                0x78467805, // ldrb  r5, [r0];              ldrb  r6, [r0, #1]
+                0x02363002, // adds  r0, #2;                lsls  r6, r6, #8
+                0x1b554335, // orrs  r5, r6;                subs  r5, r2, r5
+                0x3501782c, // copy_loop: ldrb r4, [r5];    adds  r5, #1
+                0x32017014, // strb  r4, [r2];              adds  r2, #1
+                0xd1f93b01, // subs  r3, #1;                bne   copy_loop
+                0x0015e7e3, // b     token_loop;            expanded: movs r5, r2
+                0x479869bb, // ldr   r3, [r7, #24];         blx   r3
+                0x479869fb, // ldr   r3, [r7, #28];         blx   r3
+                0x6ab8697e, // ldr   r6, [r7, #20];         ldr   r0, [r7, #40]
+                0xd0012800, // cmp   r0, #0;                beq   erase
+                0xf830f000, // bl    wait_ready
+                0x6ab868bc, // erase: ldr r4, [r7, #8];     ldr   r0, [r7, #40]
+                0x1a091ba9, // subs  r1, r5, r6;            subs  r1, r1, r0
+                0x1820d905, // bls   page_loop;             adds  r0, r4, r0
+                0x469c6a3b, // ldr   r3, [r7, #32];         mov   ip, r3
+                0x693b68fa, // ldr   r2, [r7, #12];         ldr   r3, [r7, #16]
+                0x42ae47e0, // blx   ip;                    page_loop: cmp r6, r5
+                0x2100d214, // bhs   programmed;            movs  r1, #0
+                0x200043c9, // mvns  r1, r1;                movs  r0, #0
+                0x40115832, // blank_loop: ldr r2, [r6, r0]; ands  r1, r2
+                0x0a023004, // adds  r0, #4;                lsrs  r2, r0, #8
+                0x3101d0fa, // beq   blank_loop;            adds  r1, #1
+                0x0020d005, // beq   next_page;             movs  r0, r4
+                0x22010031, // movs  r1, r6;                movs  r2, #1
+                0x6a7b0212, // lsls  r2, r2, #8;            ldr   r3, [r7, #36]
+                0x20014798, // blx   r3;                    next_page: movs r0, #1
+                0x18240200, // lsls  r0, r0, #8;            adds  r4, r0
+                0xe7e81836, // adds  r6, r0;                b     page_loop
+                0x28006af8, // programmed: ldr r0, [r7, #44]; cmp   r0, #0
+                0x0039d008, // beq   done;                  movs  r1, r7
+                0x22013138, // adds  r1, #56;               movs  r2, #1
+                0xf80ff000, // bl    spi_cmd
+                0x2204390d, // subs  r1, #13;               movs  r2, #4
+                0xf80bf000, // bl    spi_cmd
+                0x46c0bdf0, // done: pop {r4, r5, r6, r7, pc}; nop
+                0x0039b500, // wait_ready: push {lr};       wait_loop: movs r1, r7
+                0x22023139, // adds  r1, #57;               movs  r2, #2
+                0xf803f000, // bl    spi_cmd
+                0xd2f80840, // lsrs  r0, r0, #1;            bcs   wait_loop
+                0x6b7bbd00, // pop   {pc};                  spi_cmd: ldr r3, [r7, #52]
+                0x02002002, // movs  r0, #2;                lsls  r0, r0, #8
+                0x6b3b6018, // str   r0, [r3];              ldr   r3, [r7, #48]
+                0x31017808, // byte_loop: ldrb r0, [r1];    adds  r1, #1
+                0x6a986618, // str   r0, [r3, #96];         rx_wait: ldr r0, [r3, #40]
+                0xd5fc0700, // lsls  r0, r0, #28;           bpl   rx_wait
+                0x3a016e18, // ldr   r0, [r3, #96];         subs  r2, #1
+                0x6b7bd1f6, // bne   byte_loop;             ldr   r3, [r7, #52]
+                0x02122203, // movs  r2, #3;                lsls  r2, r2, #8
+                0x4770601a, // str   r2, [r3];              bx    lr
+        };
+        const uint32_t num_params = 15;
+        const uint32_t data_base = program_base + (program.size() + num_params) * sizeof(uint32_t);
+        vector<uint8_t> compressed = compress_flash_data(data, len);
+        // not worth an exec unless it saves at least an eighth of the data, or the previous program started erasing
+        // this block
+        if (compressed.size() > len - len / 8 && !erase_started_size) {
+            return false;
+        }
+        assert(data_base + compressed.size() <= output_base);
+        if (flash_functions.empty()) {
+            for (auto code : {rom_table_code('I','F'), rom_table_code('E','X'), rom_table_code('R','E'), rom_table_code('R','P')}) {
+                flash_functions.push_back(bootrom_func_lookup_rp2040(*this, code));
+            }
+        }
+        bool block_erase = can_block_erase();
+        // only start an erase which outlasts the program when nothing else (such as the mass storage interface) can
+        // read the flash before the next program
+        uint32_t next_erase = 0;
+        uint32_t next_erase_size = 0;
+        if (next_len && connection.is_exclusive()) {
+            uint32_t next = address + len - FLASH_START;
+            uint8_t cmd = FLASH_SECTOR_ERASE_CMD;
+            next_erase_size = FLASH_SECTOR_ERASE_SIZE;
+            if (block_erase && is_size_aligned(next, FLASH_BLOCK_ERASE_SIZE) && next_len >= FLASH_BLOCK_ERASE_SIZE) {
+                cmd = FLASH_BLOCK_ERASE_CMD;
+                next_erase_size = FLASH_BLOCK_ERASE_SIZE;
+            }
+            // sent in this byte order
+            next_erase = cmd | ((next >> 16) & 0xff) << 8 | ((next >> 8) & 0xff) << 16 | (next & 0xff) << 24;
+        }
+        vector<uint32_t> header = program;
+        header.insert(header.end(), {
+                data_base,
+                data_base + (uint32_t)compressed.size(),
+                address - FLASH_START,
+                block_erase ? FLASH_BLOCK_ERASE_SIZE : FLASH_SECTOR_ERASE_SIZE,
+                block_erase ? FLASH_BLOCK_ERASE_CMD : FLASH_SECTOR_ERASE_CMD,
+                output_base,
+        });
+        header.insert(header.end(), flash_functions.cbegin(), flash_functions.cend());
+        header.insert(header.end(), {
+                erase_started_size,
+                next_erase,
+                XIP_SSI_BASE_RP2040,
+                IO_QSPI_BASE_RP2040 + 0x0c, // GPIO_QSPI_SS_CTRL
+                FLASH_WRITE_ENABLE_CMD | FLASH_READ_STATUS_CMD << 8,
+        });
+        assert(header.size() == program.size() + num_params);
+        images.emplace_back((const uint8_t *)header.data(), (const uint8_t *)(header.data() + header.size()));
+        auto &image = images.back();
+        image.insert(image.end(), compressed.cbegin(), compressed.cend());
+        flash_changed();
+        if (!compressed_flash_checked) {
+            // run the first one straight away, so the bootrom commands can still be used if the device won't run it
+            try {
+                connection.write(program_base, image.data(), image.size());
+                connection.exec(program_base);
+            } catch (picoboot::command_failure &e) {
+                DEBUG_LOG("Compressed flash programming failed (%s), falling back to the bootrom\n", e.what());
+                enable_compressed_flash = false;
+                images.pop_back();
+                return false;
+            }
+            compressed_flash_checked = true;
+        } else {
+            connection.write_async(program_base, image.data(), image.size());
+            connection.exec_async(program_base);
+            num_cmds += 2;
+        }
+        erase_started_address = address + len;
+        erase_started_size = next_erase_size;
+        return true;
+    }
+
     // note this does not automatically erase flash unless erase is set
     void write(uint32_t address, uint8_t *buffer, unsigned int size) override {
         vector<uint8_t> write_data; // used when erasing flash
         if (flash == get_memory_type(address, model)) {
             connection.exit_xip();
+            profile->flash_changed();
             // Flash Translation Layer - auto-erase, and only write changed data
             if (enable_ftl) {
-                // Check what's there already
-                write_data.resize(size);
-                read(address, write_data.data(), size, false);
+                // Check what's there already, in all the sectors we might have to erase
+                range aligned_range(address & ~(FLASH_SECTOR_ERASE_SIZE - 1),
+                                    (address + size + FLASH_SECTOR_ERASE_SIZE - 1) & ~(FLASH_SECTOR_ERASE_SIZE - 1));
+                uint32_t pre_len = address - aligned_range.from;
+                write_data.resize(aligned_range.len());
+                read(aligned_range.from, write_data.data(), write_data.size(), false);
                 // Check if we even need to write
-                if (std::equal(write_data.cbegin(), write_data.cend(), buffer)) {
+                if (std::equal(buffer, buffer + size, write_data.cbegin() + pre_len)) {
                     return;
                 }
-                // Check if we need to erase (ie check for bits that need to be set)
-                bool do_erase = false;
-                for (int i = 0; i < write_data.size(); i++) {
-                    if (buffer[i] & ~write_data[i]) {
-                        do_erase = true;
-                        break;
+                // Find the sectors we need to erase (ie with bits that need to be set), merging contiguous ones
+                vector<range> erase_ranges;
+                for (uint32_t sector = aligned_range.from; sector < aligned_range.to; sector += FLASH_SECTOR_ERASE_SIZE) {
+                    range r(std::max(sector, address), std::min(sector + FLASH_SECTOR_ERASE_SIZE, address + size));
+                    const uint8_t *old_data = write_data.data() + (r.from - aligned_range.from);
+                    const uint8_t *new_data = buffer + (r.from - address);
+                    bool do_erase = false;
+                    for (uint32_t i = 0; i < r.len(); i++) {
+                        if (new_data[i] & ~old_data[i]) {
+                            do_erase = true;
+                            break;
+                        }
+                    }
+                    if (!do_erase) continue;
+                    if (!erase_ranges.empty() && erase_ranges.back().to == sector) {
+                        erase_ranges.back().to += FLASH_SECTOR_ERASE_SIZE;
+                    } else {
+                        erase_ranges.emplace_back(sector, sector + FLASH_SECTOR_ERASE_SIZE);
                     }
                 }
-                if (do_erase) {
-                    // Automatically erase flash, and make it aligned
-                    // we have to erase in whole pages
-                    range aligned_range(address & ~(FLASH_SECTOR_ERASE_SIZE - 1),
-                                        ((address + size) & ~(FLASH_SECTOR_ERASE_SIZE - 1)) + FLASH_SECTOR_ERASE_SIZE);
-                    assert(aligned_range.contains(address));
-                    assert(aligned_range.contains(address + size));
-
-                    uint32_t pre_len = address - aligned_range.from;
-                    uint32_t post_len = aligned_range.to - (address + size);
-                    assert(pre_len + size + post_len == aligned_range.len());
-
-                    // save data before the changing data
-                    write_data.resize(pre_len);
-                    if (pre_len) read(aligned_range.from, write_data.data(), write_data.size(), false);
+                if (!erase_ranges.empty()) {
                     // now add the data that is changing
-                    write_data.insert(write_data.end(), buffer, buffer + size);
-                    // save data after the changing data
-                    write_data.resize(aligned_range.len());
-                    if (post_len) read(address + size, write_data.data() + pre_len + size, post_len, false);
+                    std::copy(buffer, buffer + size, write_data.begin() + pre_len);
 
                     // Do the erase
-                    connection.flash_erase(aligned_range.from, aligned_range.len());
+                    for (const auto &r : erase_ranges) {
+                        for (const auto &e : plan_flash_erase(r, can_block_erase())) {
+                            connection.flash_erase(e.from, e.len());
+                        }
+                    }
 
-                    // Update what will now be written
-                    address = aligned_range.from;
-                    buffer = write_data.data();
-                    size = aligned_range.len();
+                    // Update what will now be written; erased sectors must be rewritten in full, and rewriting the
+                    // unchanged data in any sectors between them is harmless
+                    range write_range(std::min(address, erase_ranges.front().from), std::max(address + size, erase_ranges.back().to));
+                    buffer = write_data.data() + (write_range.from - aligned_range.from);
+                    address = write_range.from;
+                    size = write_range.len();
                 }
             }
         }
@@ -2584,13 +3398,111 @@ struct picoboot_memory_access : public memory_access {
 
     // Enable Flash Translation Layer, which performs automatic erase, and only writes changed data
     bool enable_ftl = false;
+    // Allow read_flash_crcs and read_flash_blank to use XIP SRAM on the device as a workspace
+    bool enable_device_crcs = false;
+    // Allow program_flash_compressed to use SRAM on the device as a workspace
+    bool enable_compressed_flash = false;
+    // Allow get_flash_size to probe the flash, using XIP SRAM on the device as a workspace
+    bool enable_flash_probe = false;
 private:
+    // read the pages from..to (which must be page aligned) into the cache, keeping any pages already cached
+    void fill_cache(uint32_t from, uint32_t to) {
+        DEBUG_LOG("Flash Caching %08x+%08x\n", from, to - from);
+        vector<uint8_t> data(to - from);
+        read_raw(from, data.data(), data.size());
+        auto it = flash_cache.lower_bound(from);
+        for (uint32_t p = from; p < to; p += PAGE_SIZE) {
+            if (it == flash_cache.end() || it->first != p) {
+                it = flash_cache.emplace_hint(it, p, std::array<uint8_t, PAGE_SIZE>());
+                std::copy(data.cbegin() + (p - from), data.cbegin() + (p - from + PAGE_SIZE), it->second.begin());
+                flash_cache_misses++;
+            }
+            it++;
+        }
+    }
+
+    // read the ROM pages from..to (which must be page aligned) into the profile's snapshot, keeping any pages already
+    // there; the caller must hold the snapshot's mutex
+    void fill_rom_cache(uint32_t from, uint32_t to) {
+        DEBUG_LOG("ROM Caching %08x+%08x\n", from, to - from);
+        vector<uint8_t> data(to - from);
+        read_raw(from, data.data(), data.size());
+        auto &pages = profile->rom->pages;
+        auto it = pages.lower_bound(from);
+        for (uint32_t p = from; p < to; p += PAGE_SIZE) {
+            if (it == pages.end() || it->first != p) {
+                it = pages.emplace_hint(it, p, std::array<uint8_t, PAGE_SIZE>());
+                std::copy(data.cbegin() + (p - from), data.cbegin() + (p - from + PAGE_SIZE), it->second.begin());
+            }
+            it++;
+        }
+    }
+
     picoboot::connection& connection;
-    vector<std::tuple<uint32_t,uint32_t,vector<uint8_t>>> flash_cache;
+    std::shared_ptr<device_profile> profile;
+    std::map<uint32_t, std::array<uint8_t, PAGE_SIZE>> flash_cache;
+    uint32_t flash_cache_hits = 0;
+    uint32_t flash_cache_misses = 0;
+    // the bootrom functions used by program_flash_compressed, once looked up
+    vector<uint32_t> flash_functions;
+    bool compressed_flash_checked = false;
+    // the flash following the last block programmed by program_flash_compressed which it started erasing, if any
+    uint32_t erase_started_address = 0;
+    uint32_t erase_started_size = 0;
+    bool device_crcs_checked = false;
 };
+
+// Device CRCs use XIP SRAM, so can't be used when it is also being verified
+static bool can_use_device_crcs(const vector<range> &ranges, const model_t &model) {
+    return std::none_of(ranges.cbegin(), ranges.cend(), [&](const range &r) {
+        return get_memory_type(r.from, model) == xip_sram;
+    });
+}
+
+// Compressed flash programming uses SRAM, so can't be used when it is also being loaded
+static bool can_use_compressed_flash(const vector<range> &ranges, const model_t &model) {
+    return std::none_of(ranges.cbegin(), ranges.cend(), [&](const range &r) {
+        auto type = get_memory_type(r.from, model);
+        return type == sram || type == sram_unstriped;
+    });
+}
+
+// Returns the address of the first byte on the device which differs from expected (which is at addr), or
+// addr + expected.size() if they match. Whole flash sectors are compared by CRC where the device supports it,
+// and only a mismatching sector (or anything that couldn't be compared that way) is read back.
+static uint32_t find_device_mismatch(picoboot_memory_access &raw_access, uint32_t addr, const vector<uint8_t> &expected) {
+    // read back len bytes at offset, returning the offset of the first difference, or offset + len if they match
+    auto compare_read_back = [&](uint32_t offset, uint32_t len) {
+        vector<uint8_t> device_buf;
+        raw_access.read_into_vector(addr + offset, len, device_buf);
+        auto mismatch = std::mismatch(device_buf.cbegin(), device_buf.cend(), expected.cbegin() + offset);
+        return offset + (uint32_t)(mismatch.first - device_buf.cbegin());
+    };
+    uint32_t checked = 0;
+    uint32_t num_sectors = expected.size() / FLASH_SECTOR_ERASE_SIZE;
+    vector<uint32_t> crcs;
+    if (num_sectors && raw_access.read_flash_crcs(addr, num_sectors, crcs)) {
+        while (checked < num_sectors * FLASH_SECTOR_ERASE_SIZE) {
+            if (crc32_sw(expected.data() + checked, FLASH_SECTOR_ERASE_SIZE, 0xffffffff) != crcs[checked / FLASH_SECTOR_ERASE_SIZE]) {
+                // CRC mismatch, so read back just that sector to find the first difference; if there is none (the
+                // device changed, or the CRC was wrong) carry on with the next sector
+                uint32_t pos = compare_read_back(checked, FLASH_SECTOR_ERASE_SIZE);
+                if (pos != checked + FLASH_SECTOR_ERASE_SIZE) {
+                    return addr + pos;
+                }
+            }
+            checked += FLASH_SECTOR_ERASE_SIZE;
+        }
+    }
+    if (checked < expected.size()) {
+        checked = compare_read_back(checked, expected.size() - checked);
+    }
+    return addr + checked;
+}
 #endif
 
 
+// File data is read into memory on first use, rather than seeking and reading the stream for each access
 struct iostream_memory_access : public memory_access {
     iostream_memory_access(std::shared_ptr<std::iostream> file, range_map<size_t>& rmap, uint32_t binary_start) : file(file), rmap(rmap), binary_start(binary_start) {
 
@@ -2618,23 +3530,19 @@ struct iostream_memory_access : public memory_access {
                 return;
             }
         }
+        read_all();
         while (size) {
             unsigned int this_size;
-            try {
-                auto result = rmap.get(address);
-                this_size = std::min(size, result.first.max_offset - result.first.offset);
-                assert(this_size);
-                file->seekg(result.second + result.first.offset, ios::beg);
-                file->read((char*)buffer, this_size);
-            } catch (not_mapped_exception &) {
-                if (zero_fill) {
-                    // address is not in a range, so fill up to next range with zeros
-                    this_size = rmap.next(address) - address;
-                    this_size = std::min(this_size, size);
-                    memset(buffer, 0, this_size);
-                } else {
-                    throw;
-                }
+            auto seg = find_segment(address);
+            if (seg != data->segments.cend() && seg->from <= address) {
+                this_size = std::min(size, seg->to - address);
+                memcpy(buffer, data->bytes.data() + seg->offset + (address - seg->from), this_size);
+            } else if (zero_fill) {
+                // address is not in a range, so fill up to next range with zeros
+                this_size = seg == data->segments.cend() ? size : std::min(size, seg->from - address);
+                memset(buffer, 0, this_size);
+            } else {
+                throw not_mapped_exception(address);
             }
             buffer += this_size;
             address += this_size;
@@ -2642,6 +3550,17 @@ struct iostream_memory_access : public memory_access {
         }
     }
 
+    // Returns a pointer to the data for address to address + size if it is all mapped, or nullptr if it isn't. The
+    // pointer remains valid for the lifetime of this (and any copies of this)
+    const uint8_t *span(uint32_t address, uint32_t size) {
+        read_all();
+        auto seg = find_segment(address);
+        if (seg == data->segments.cend() || seg->from > address || seg->to - address < size) {
+            return nullptr;
+        }
+        return data->bytes.data() + seg->offset + (address - seg->from);
+    }
+
     void write(uint32_t address, uint8_t *buffer, uint32_t size) override {
         while (size) {
             unsigned int this_size;
@@ -2653,6 +3572,11 @@ struct iostream_memory_access : public memory_access {
             if (file->fail()) {
                 fail(ERROR_WRITE_FAILED, "Write to file failed");
             }
+            if (data) {
+                auto seg = find_segment(address);
+                assert(seg != data->segments.cend() && seg->from <= address && seg->to - address >= this_size);
+                memcpy(data->bytes.data() + seg->offset + (address - seg->from), buffer, this_size);
+            }
             buffer += this_size;
             address += this_size;
             size -= this_size;
@@ -2662,10 +3586,75 @@ struct iostream_memory_access : public memory_access {
     const range_map<size_t> &get_rmap() {
         return rmap;
     }
+
+    // Read all the mapped data into memory now, rather than on first use. Copies made afterwards share the data, so
+    // can be used to read it from other threads
+    void read_all() {
+        if (data) return;
+        data = std::make_shared<file_data>();
+        auto ranges = rmap.ranges();
+        size_t mapped_size = 0;
+        for (const auto &r : ranges) mapped_size += r.len();
+        file->clear();
+        file->seekg(0, ios::end);
+        size_t file_size = file->tellg();
+        // when most of the file is mapped (eg UF2s, which are half data) read it all at once, rather than seeking to
+        // each range
+        vector<uint8_t> whole_file;
+        if (file_size <= mapped_size * 4) {
+            whole_file.resize(file_size);
+            file->seekg(0, ios::beg);
+            file->read((char *)whole_file.data(), file_size);
+        }
+        data->bytes.reserve(mapped_size);
+        for (const auto &r : ranges) {
+            size_t file_offset = rmap.get(r.from).second;
+            if (!whole_file.empty()) {
+                if (file_offset + r.len() > whole_file.size()) {
+                    fail(ERROR_READ_FAILED, "unexpected end of input file");
+                }
+                data->bytes.insert(data->bytes.end(), whole_file.cbegin() + file_offset, whole_file.cbegin() + file_offset + r.len());
+            } else {
+                size_t pos = data->bytes.size();
+                data->bytes.resize(pos + r.len());
+                file->seekg(file_offset, ios::beg);
+                file->read((char *)data->bytes.data() + pos, r.len());
+            }
+            // store contiguous ranges as a single segment
+            if (!data->segments.empty() && data->segments.back().to == r.from) {
+                data->segments.back().to = r.to;
+            } else {
+                data->segments.push_back({r.from, r.to, data->bytes.size() - r.len()});
+            }
+        }
+        if (file->fail()) {
+            fail(ERROR_READ_FAILED, "unexpected end of input file");
+        }
+    }
 private:
+    struct file_data {
+        struct segment {
+            uint32_t from;
+            uint32_t to;
+            size_t offset; // into bytes
+        };
+        vector<segment> segments; // sorted, and not overlapping
+        vector<uint8_t> bytes;
+    };
+
+    // returns the segment containing address, or else the first one after it
+    vector<file_data::segment>::const_iterator find_segment(uint32_t address) const {
+        auto seg = std::upper_bound(data->segments.cbegin(), data->segments.cend(), address, [](uint32_t a, const file_data::segment &s) {
+            return a < s.from;
+        });
+        if (seg != data->segments.cbegin() && (seg - 1)->to > address) seg--;
+        return seg;
+    }
+
     std::shared_ptr<std::iostream>file;
     range_map<size_t> rmap;
     uint32_t binary_start;
+    std::shared_ptr<file_data> data;
 };
 
 
@@ -2714,16 +3703,36 @@ struct remapped_memory_access : public memory_access {
         return wrap.is_device();
     }
 
+    uint32_t get_flash_size() override {
+        return wrap.get_flash_size();
+    }
+
     uint32_t get_binary_start() override {
         return wrap.get_binary_start(); // this is an absolute address
     }
 
+    void prefetch(const vector<range> &ranges) override {
+        vector<range> wrapped_ranges;
+        for (auto r : ranges) {
+            while (!r.empty()) {
+                auto result = get_remapped(r.from);
+                uint32_t this_size = std::min(r.len(), result.first.max_offset - result.first.offset);
+                if (!this_size) break;
+                uint32_t from = result.second + result.first.offset;
+                wrapped_ranges.emplace_back(from, from + this_size);
+                r.from += this_size;
+            }
+        }
+        wrap.prefetch(wrapped_ranges);
+    }
+
     pair<range_map<uint32_t>::mapping, uint32_t> get_remapped(uint32_t address) {
-        try {
-            return rmap.get(address);
-        } catch (not_mapped_exception&) {
-            return std::make_pair(range_map<uint32_t>::mapping(0, rmap.next(address) - address), address);
+        auto result = rmap.lookup(address);
+        if (!result.first) {
+            // addresses which aren't remapped are passed through unchanged
+            result.second.second = address;
         }
+        return result.second;
     }
 
 private:
@@ -2749,10 +3758,26 @@ struct partition_memory_access : public memory_access {
         wrap.write(address + partition_start, buffer, size);
     }
 
+    void prefetch(const vector<range> &ranges) override {
+        vector<range> wrapped_ranges;
+        for (const auto &r : ranges) {
+            if (get_memory_type(r.from, model) == flash) {
+                wrapped_ranges.emplace_back(r.from + partition_start, r.to + partition_start);
+            } else {
+                wrapped_ranges.push_back(r);
+            }
+        }
+        wrap.prefetch(wrapped_ranges);
+    }
+
     bool is_device() override {
         return wrap.is_device();
     }
 
+    uint32_t get_flash_size() override {
+        return wrap.get_flash_size();
+    }
+
     uint32_t get_binary_start() override {
         return wrap.get_binary_start(); // this is an absolute address
     }
@@ -2810,8 +3835,9 @@ bool find_binary_info(memory_access& access, binary_info_header &hdr) {
                         from_type == to_type &&
                         is_size_aligned(from, 4) &&
                         is_size_aligned(to, 4)) {
-                    access.read_into_vector(from, (to - from) / 4, hdr.bi_addr);
                     uint32_t cpy_table = buffer[i+3];
+                    access.prefetch({range(from, to), range(cpy_table, cpy_table + 12 * 11)});
+                    access.read_into_vector(from, (to - from) / 4, hdr.bi_addr);
                     vector<uint32_t> mapping;
                     do {
                         mapping = access.read_vector<uint32_t>(cpy_table, 3);
@@ -2830,14 +3856,17 @@ bool find_binary_info(memory_access& access, binary_info_header &hdr) {
 
 string read_string(memory_access &access, uint32_t addr) {
     const unsigned int max_length = 512;
-    auto v = access.read_vector<char>(addr, max_length, true); // zero fill
-    unsigned int length;
-    for (length = 0; length < max_length; length++) {
-        if (!v[length]) {
-            break;
-        }
+    // read up to page boundaries, so a short string doesn't pull in pages it doesn't use
+    string s;
+    while (s.length() < max_length) {
+        unsigned int chunk = std::min(PAGE_SIZE - (addr & (PAGE_SIZE - 1)), max_length - (unsigned int)s.length());
+        auto v = access.read_vector<char>(addr, chunk, true); // zero fill
+        auto nul = std::find(v.cbegin(), v.cend(), '\0');
+        s.append(v.cbegin(), nul);
+        if (nul != v.cend()) break;
+        addr += chunk;
     }
-    return string(v.data(), length);
+    return s;
 }
 
 struct bi_visitor_base {
@@ -2879,22 +3908,91 @@ struct bi_visitor_base {
 
     void visit(memory_access& access, const binary_info_header& hdr) {
         chip = access.get_model()->chip();
+        prefetch(access, hdr);
         for (const auto &a : hdr.bi_addr) {
             visit(access, a);
         }
     }
 
-    void visit(memory_access& access, uint32_t addr) {
-        binary_info_core_t bi;
-        access.read_raw(addr, bi);
-        switch (bi.type) {
-            case BINARY_INFO_TYPE_RAW_DATA:
-                break;
-            case BINARY_INFO_TYPE_SIZED_DATA:
-                break;
-            case BINARY_INFO_TYPE_BINARY_INFO_LIST_ZERO_TERMINATED:
-                zero_terminated_bi_list(access, bi, addr);
-                break;
+    // Fetch all the entries, and then the strings and values they point to, so that visiting them doesn't need a
+    // separate device read for each one
+    void prefetch(memory_access& access, const binary_info_header& hdr) {
+        const uint32_t max_entry_size = std::max({sizeof(binary_info_ptr_string_with_name_t), sizeof(binary_info_block_device_t),
+                                                  sizeof(binary_info_pins64_with_name_t), sizeof(binary_info_named_group_t)});
+        const uint32_t string_size = 64; // a guess; anything longer is read when visited
+        if (!access.is_device()) return;
+        vector<range> ranges;
+        for (const auto &a : hdr.bi_addr) {
+            ranges.emplace_back(a, a + max_entry_size);
+        }
+        access.prefetch(ranges);
+        ranges.clear();
+        for (const auto &a : hdr.bi_addr) {
+            binary_info_core_t bi;
+            access.read_raw(a, bi);
+            switch (bi.type) {
+                case BINARY_INFO_TYPE_ID_AND_STRING: {
+                    binary_info_id_and_string_t value;
+                    access.read_raw(a, value);
+                    ranges.emplace_back(value.value, value.value + string_size);
+                    break;
+                }
+                case BINARY_INFO_TYPE_PTR_INT32_WITH_NAME: {
+                    binary_info_ptr_int32_with_name_t value;
+                    access.read_raw(a, value);
+                    ranges.emplace_back(value.label, value.label + string_size);
+                    ranges.emplace_back(value.value, value.value + 4);
+                    break;
+                }
+                case BINARY_INFO_TYPE_PTR_STRING_WITH_NAME: {
+                    binary_info_ptr_string_with_name_t value;
+                    access.read_raw(a, value);
+                    ranges.emplace_back(value.label, value.label + string_size);
+                    ranges.emplace_back(value.value, value.value + std::max((uint32_t)value.len, string_size));
+                    break;
+                }
+                case BINARY_INFO_TYPE_BLOCK_DEVICE: {
+                    binary_info_block_device_t value;
+                    access.read_raw(a, value);
+                    ranges.emplace_back(value.name, value.name + string_size);
+                    break;
+                }
+                case BINARY_INFO_TYPE_PINS_WITH_NAME: {
+                    binary_info_pins_with_name_t value;
+                    access.read_raw(a, value);
+                    ranges.emplace_back(value.label, value.label + string_size);
+                    break;
+                }
+                case BINARY_INFO_TYPE_PINS64_WITH_NAME: {
+                    binary_info_pins64_with_name_t value;
+                    access.read_raw(a, value);
+                    ranges.emplace_back(value.label, value.label + string_size);
+                    break;
+                }
+                case BINARY_INFO_TYPE_NAMED_GROUP: {
+                    binary_info_named_group_t value;
+                    access.read_raw(a, value);
+                    ranges.emplace_back(value.label, value.label + string_size);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        access.prefetch(ranges);
+    }
+
+    void visit(memory_access& access, uint32_t addr) {
+        binary_info_core_t bi;
+        access.read_raw(addr, bi);
+        switch (bi.type) {
+            case BINARY_INFO_TYPE_RAW_DATA:
+                break;
+            case BINARY_INFO_TYPE_SIZED_DATA:
+                break;
+            case BINARY_INFO_TYPE_BINARY_INFO_LIST_ZERO_TERMINATED:
+                zero_terminated_bi_list(access, bi, addr);
+                break;
             case BINARY_INFO_TYPE_BSON:
                 break;
             case BINARY_INFO_TYPE_ID_AND_INT: {
@@ -3175,6 +4273,11 @@ protected:
 
 uint32_t guess_flash_size(memory_access &access) {
     assert(access.is_device());
+    // use the size the flash reports, if it can be asked; this also works when the flash is erased
+    uint32_t reported_size = access.get_flash_size();
+    if (reported_size) {
+        return reported_size;
+    }
     // Check that flash is not erased (TODO should check for second stage)
     auto first_two_pages = access.read_vector<uint8_t>(FLASH_START, 2 * PAGE_SIZE);
     bool all_match = std::equal(first_two_pages.begin(),
@@ -3216,13 +4319,43 @@ bool string_to_hex_array(const string& str, uint8_t *array, size_t size, const s
     return false;
 }
 
-std::shared_ptr<std::fstream> get_file_idx(ios::openmode mode, uint8_t idx) {
-    auto filename = settings.filenames[idx];
+// Index of the blocks in a UF2 file, built in a single pass, so that the file can be used for each of its family IDs
+// (e.g. by info) and by several commands without scanning it again
+struct uf2_index {
+    struct family {
+        uint32_t family_id;
+        range_map<size_t> rmap; // target address -> file offset of the block data
+        uint32_t block_count = 0;
+        uint32_t num_blocks = 0; // as given by the blocks
+        bool num_blocks_consistent = true; // all blocks give the same num_blocks, which matches block_count
+    };
+
+    // a family_id of 0 means the first family in the file
+    vector<family>::const_iterator find_family(uint32_t family_id) const {
+        if (!family_id) return families.begin();
+        return std::find_if(families.begin(), families.end(), [&](const family &f) { return f.family_id == family_id; });
+    }
+
+    size_t file_size = 0;
+    vector<family> families; // in the order they first appear in the file
+    bool has_abs_block = false; // RP2350-E10 absolute block before any other blocks
+    uint32_t abs_block_loc = 0;
+};
+
+// indexes of the UF2 files used by this command, by filename
+static std::map<string, std::shared_ptr<const uf2_index>> uf2_indexes;
+
+std::shared_ptr<std::fstream> get_file_named(ios::openmode mode, const string &filename) {
+    if (mode & ios::out) uf2_indexes.erase(filename);
     auto file = std::make_shared<std::fstream>(filename, mode);
     if (file->fail()) fail(ERROR_READ_FAILED, "Could not open '%s'", filename.c_str());
     return file;
 }
 
+std::shared_ptr<std::fstream> get_file_idx(ios::openmode mode, uint8_t idx) {
+    return get_file_named(mode, settings.filenames[idx]);
+}
+
 std::shared_ptr<std::fstream> get_file(ios::openmode mode) {
     return get_file_idx(mode, 0);
 }
@@ -3301,62 +4434,107 @@ void build_rmap_elf(std::shared_ptr<std::iostream>file, range_map<size_t>& rmap)
     }
 }
 
-uint32_t build_rmap_uf2(std::shared_ptr<std::iostream>file, range_map<size_t>& rmap, uint32_t family_id=0) {
+// Call fn(block, pos) for each block in a UF2 file with valid magic numbers. The file is read in large chunks, rather
+// than one block at a time
+template <typename F> void for_each_uf2_block(std::shared_ptr<std::iostream> file, F fn) {
     file->seekg(0, ios::beg);
-    uf2_block block;
-    unsigned int pos = 0;
-    uint32_t next_family_id = 0;
+    vector<uf2_block> chunk(UF2_SCAN_CHUNK_BLOCKS);
+    size_t pos = 0;
     do {
-        file->read((char*)&block, sizeof(uf2_block));
+        file->read((char*)chunk.data(), chunk.size() * sizeof(uf2_block));
+        // a partial block at the end of the file is ignored
+        size_t count = file->gcount() / sizeof(uf2_block);
+        for (size_t i = 0; i < count; i++, pos += sizeof(uf2_block)) {
+            const uf2_block &block = chunk[i];
+            // check all the magic numbers with a single branch, as they are almost always valid
+            if (!((block.magic_start0 ^ UF2_MAGIC_START0) | (block.magic_start1 ^ UF2_MAGIC_START1) |
+                  (block.magic_end ^ UF2_MAGIC_END))) {
+                fn(block, pos);
+            }
+        }
         if (file->fail()) {
             if (file->eof()) { file->clear(); break; }
             fail(ERROR_READ_FAILED, "unexpected end of input file");
         }
-        if (block.magic_start0 == UF2_MAGIC_START0 && block.magic_start1 == UF2_MAGIC_START1 &&
-            block.magic_end == UF2_MAGIC_END) {
-            if (block.flags & UF2_FLAG_FAMILY_ID_PRESENT &&
-                !(block.flags & UF2_FLAG_NOT_MAIN_FLASH) && block.payload_size == PAGE_SIZE &&
-                (!family_id || block.file_size == family_id)) {
-                #if SUPPORT_RP2350_A2
-                // ignore the absolute block, but save the address
-                if (check_abs_block(block)) {
-                    DEBUG_LOG("Ignoring RP2350-E10 absolute block\n");
-                    settings.uf2.abs_block_loc = block.target_addr;
-                } else {
-                    rmap.insert(range(block.target_addr, block.target_addr + PAGE_SIZE), pos + offsetof(uf2_block, data[0]));
-                    family_id = block.file_size;
-                    next_family_id = 0;
-                }
-                #else
-                rmap.insert(range(block.target_addr, block.target_addr + PAGE_SIZE), pos + offsetof(uf2_block, data[0]));
-                family_id = block.file_size;
-                next_family_id = 0;
-                #endif
-            } else if (block.file_size != family_id && family_id && !next_family_id) {
-                #if SUPPORT_RP2350_A2
-                if (!check_abs_block(block)) {
-                #endif
-                    next_family_id = block.file_size;
-                #if SUPPORT_RP2350_A2
-                }
-                #endif
+    } while (true);
+}
+
+static bool is_abs_block(const uf2_block &block) {
+    // check the family first, as check_abs_block checks the whole payload
+    return block.file_size == ABSOLUTE_FAMILY_ID && check_abs_block(block);
+}
+
+std::shared_ptr<const uf2_index> get_uf2_index(std::shared_ptr<std::iostream> file, const string &filename = "") {
+    file->seekg(0, ios::end);
+    size_t file_size = file->tellg();
+    if (!filename.empty()) {
+        auto cached = uf2_indexes.find(filename);
+        if (cached != uf2_indexes.end() && cached->second->file_size == file_size) {
+            return cached->second;
+        }
+    }
+    auto index = std::make_shared<uf2_index>();
+    index->file_size = file_size;
+    for_each_uf2_block(file, [&](const uf2_block &block, size_t pos) {
+        if (!(block.flags & UF2_FLAG_FAMILY_ID_PRESENT) ||
+            (block.flags & UF2_FLAG_NOT_MAIN_FLASH) || block.payload_size != PAGE_SIZE) {
+            return;
+        }
+        if (is_abs_block(block)) {
+            if (index->families.empty() && !index->has_abs_block) {
+                index->has_abs_block = true;
+                index->abs_block_loc = block.target_addr;
             }
+            return;
         }
-        pos += sizeof(uf2_block);
-    } while (true);
+        auto f = std::find_if(index->families.begin(), index->families.end(), [&](const uf2_index::family &f) {
+            return f.family_id == block.file_size;
+        });
+        if (f == index->families.end()) {
+            index->families.emplace_back();
+            f = index->families.end() - 1;
+            f->family_id = block.file_size;
+            f->num_blocks = block.num_blocks;
+        } else if (block.num_blocks != f->num_blocks) {
+            f->num_blocks_consistent = false;
+        }
+        f->rmap.append(range(block.target_addr, block.target_addr + PAGE_SIZE), pos + offsetof(uf2_block, data[0]));
+        f->block_count++;
+    });
+    for (auto &f : index->families) {
+        if (f.block_count != f.num_blocks) f.num_blocks_consistent = false;
+        if (!f.num_blocks_consistent) {
+            DEBUG_LOG("UF2 family ID %s has %d blocks, which doesn't match num_blocks\n", family_name(f.family_id).c_str(), f.block_count);
+        }
+    }
+    if (!filename.empty()) uf2_indexes[filename] = index;
+    return index;
+}
 
-    return next_family_id;
+uint32_t build_rmap_uf2(const uf2_index &index, range_map<size_t>& rmap, uint32_t family_id=0) {
+    #if SUPPORT_RP2350_A2
+    // ignore the absolute block, but save the address
+    if (index.has_abs_block && !family_id) {
+        DEBUG_LOG("Ignoring RP2350-E10 absolute block\n");
+        settings.uf2.abs_block_loc = index.abs_block_loc;
+    }
+    #endif
+    auto f = index.find_family(family_id);
+    if (f == index.families.end()) return 0;
+    rmap = f->rmap;
+    return ++f != index.families.end() ? f->family_id : 0;
 }
 
 void build_rmap_load_map(std::shared_ptr<load_map_item>load_map, range_map<uint32_t>& rmap) {
     for (unsigned int i=0; i < load_map->entries.size(); i++) {
         auto e = load_map->entries[i];
         if (e.storage_address != 0) {
-            try {
-                rmap.insert(range(e.runtime_address, e.runtime_address + e.size), e.storage_address);
-            } catch (failure_error&) {
+            range r(e.runtime_address, e.runtime_address + e.size);
+            if (rmap.overlaps(r)) {
                 // Overlapping memory ranges are permitted in a load_map, so overwrite overlapping range
-                rmap.insert_overwrite(range(e.runtime_address, e.runtime_address + e.size), e.storage_address);
+                rmap.insert_overwrite(r, e.storage_address);
+            } else {
+                rmap.insert(r, e.storage_address);
             }
         }
     }
@@ -3383,7 +4561,7 @@ uint32_t find_binary_start(range_map<size_t>& rmap) {
     return binary_start;
 }
 
-template <typename ACCESS, typename STREAM> ACCESS get_iostream_memory_access(std::shared_ptr<STREAM> file, filetype type, bool writeable = false, uint32_t *next_family_id=nullptr) {
+template <typename ACCESS, typename STREAM> ACCESS get_iostream_memory_access(std::shared_ptr<STREAM> file, filetype type, bool writeable = false, uint32_t *next_family_id=nullptr, const string &filename = "") {
     range_map<size_t> rmap;
     uint32_t binary_start = 0;
     uint32_t tmp = 0;
@@ -3399,7 +4577,7 @@ template <typename ACCESS, typename STREAM> ACCESS get_iostream_memory_access(st
             binary_start = find_binary_start(rmap);
             break;
         case filetype::uf2:
-            tmp = build_rmap_uf2(file, rmap, tmp);
+            tmp = build_rmap_uf2(*get_uf2_index(file, filename), rmap, tmp);
             if (next_family_id != nullptr) {
                 *next_family_id = tmp;
             } else if (tmp) {
@@ -3423,7 +4601,7 @@ file_memory_access get_file_memory_access(uint8_t idx, bool writeable = false, u
     ios::openmode mode = (writeable ? ios::out|ios::in : ios::in)|ios::binary;
     auto file = get_file_idx(mode, idx);
     try {
-        return get_iostream_memory_access<file_memory_access>(file, get_file_type_idx(idx), writeable, next_family_id);
+        return get_iostream_memory_access<file_memory_access>(file, get_file_type_idx(idx), writeable, next_family_id, settings.filenames[idx]);
     } catch (std::exception&) {
         file->close();
         throw;
@@ -4232,9 +5410,7 @@ void info_guts(memory_access &raw_access, void *con, bool no_pt_loaded=false) {
                 if (size_guess > 0) {
                     info_pair("flash size", std::to_string(size_guess/1024) + "K");
                     if (model->chip() == rp2040) {
-                        uint64_t flash_id = 0;
-                        con->flash_id(flash_id);
-                        info_pair("flash id", hex_string(flash_id, 16, true, true));
+                        info_pair("flash id", hex_string(get_flash_id(*con), 16, true, true));
                     }
                 }
             } catch (picoboot::command_failure &e) {
@@ -4538,17 +5714,11 @@ uint32_t get_family_id(uint8_t file_idx) {
         auto file_access = get_file_memory_access(file_idx);
         family_id = get_access_model(file_access)->family_id();
     } else if (get_file_type_idx(file_idx) == filetype::uf2) {
-        auto file = get_file_idx(ios::in|ios::binary, file_idx);
-        uf2_block block;
-        file->read((char*)&block, sizeof(block));
-        #if SUPPORT_RP2350_A2
-        // ignore the absolute block
-        if (check_abs_block(block)) {
-            DEBUG_LOG("Ignoring RP2350-E10 absolute block\n");
-            file->read((char*)&block, sizeof(block));
+        // the absolute block is not one of the families
+        auto index = get_uf2_index(get_file_idx(ios::in|ios::binary, file_idx), settings.filenames[file_idx]);
+        if (!index->families.empty()) {
+            family_id = index->families.front().family_id;
         }
-        #endif
-        family_id = block.file_size;
     } else {
         // todo this can be done - need to add block search for bin files
         fail(ERROR_FORMAT, "Cannot autodetect UF2 family - must specify the family\n");
@@ -4583,7 +5753,7 @@ struct partition_details {
     vector<uint32_t> extra_families = {};
 };
 
-std::shared_ptr<tuple<resident_partition_t, std::shared_ptr<vector<partition_details>>>> get_partition_info(picoboot::connection &con) {
+static std::shared_ptr<partition_info_t> read_partition_info(picoboot::connection &con) {
     picoboot_memory_access raw_access(con);
     auto model = raw_access.get_model();
     if (!model->supports_partition_table()) {
@@ -4613,7 +5783,7 @@ std::shared_ptr<tuple<resident_partition_t, std::shared_ptr<vector<partition_det
 
     if (!has_pt) {
         // there is no partition table
-        return std::make_shared<tuple<resident_partition_t, std::shared_ptr<vector<partition_details>>>>(std::make_tuple(unpartitioned, nullptr));
+        return std::make_shared<partition_info_t>(std::make_tuple(unpartitioned, nullptr));
     }
 
     vector<partition_details> ret;
@@ -4666,7 +5836,17 @@ std::shared_ptr<tuple<resident_partition_t, std::shared_ptr<vector<partition_det
         }
     }
 
-    return std::make_shared<tuple<resident_partition_t, std::shared_ptr<vector<partition_details>>>>(std::make_tuple(unpartitioned, std::make_shared<vector<partition_details>>(ret)));
+    return std::make_shared<partition_info_t>(std::make_tuple(unpartitioned, std::make_shared<vector<partition_details>>(ret)));
+}
+
+// the partition table is only read from the device once per connection, unless the flash is changed
+std::shared_ptr<partition_info_t> get_partition_info(picoboot::connection &con) {
+    auto profile = get_device_profile(con);
+    if (!profile->has_partition_info) {
+        profile->partition_info = read_partition_info(con);
+        profile->has_partition_info = true;
+    }
+    return profile->partition_info;
 }
 
 std::shared_ptr<vector<partition_details>> get_partitions(picoboot::connection &con) {
@@ -4885,6 +6065,13 @@ struct progress_bar {
     void progress(int _percent) {
         if (_percent != percent) {
             percent = _percent;
+#if HAS_LIBUSB
+            if (thread_load_status) {
+                std::lock_guard<std::mutex> lock(thread_load_status->mutex);
+                thread_load_status->percent = percent;
+                return;
+            }
+#endif
             unsigned int len = (width * percent) / 100;
             std::cout << prefix << "[" << string(len, '=') << string(width-len, ' ') << "]  " << std::to_string(percent) << "%\r" << std::flush;
         }
@@ -4895,6 +6082,14 @@ struct progress_bar {
     }
 
     ~progress_bar() {
+#if HAS_LIBUSB
+        if (thread_load_status) {
+            std::lock_guard<std::mutex> lock(thread_load_status->mutex);
+            thread_load_status->bars_finished++;
+            thread_load_status->percent = 0;
+            return;
+        }
+#endif
         std::cout << "\n";
     }
 
@@ -4979,6 +6174,7 @@ bool save_command::execute(device_map &devices) {
             }
         }
     } else {
+        raw_access.enable_flash_probe = true;
         end = FLASH_START + guess_flash_size(raw_access);
         if (end <= FLASH_START) {
             fail(ERROR_NOT_POSSIBLE, "Cannot determine the flash size, so cannot save the entirety of flash, try --range.");
@@ -4993,6 +6189,10 @@ bool save_command::execute(device_map &devices) {
     }
     uint32_t size = end - start;
     uint32_t chunk_size = calculate_chunk_size(size);
+    // erased sectors are left out of UF2 files, and when the device can check for them itself, they aren't read
+    bool skip_blank = settings.save.all && !settings.save.keep_blank;
+    raw_access.enable_device_crcs = skip_blank; // only flash is being saved, so XIP SRAM can be used
+    uint32_t uf2_blocks_written = 0;
 
     std::function<void(FILE *out, const uint8_t *buffer, unsigned int size, unsigned int offset)> writer256 = [](FILE *out, const uint8_t *buffer, unsigned int size, unsigned int offset) { assert(false); };
     uf2_block block;
@@ -5023,7 +6223,7 @@ bool save_command::execute(device_map &devices) {
             writer256 = [&](FILE *out, const uint8_t *buffer, unsigned int size, unsigned int offset) {
                 static_assert(512 == sizeof(block), "");
                 block.target_addr = start + offset;
-                block.block_no = offset / PAGE_SIZE;
+                block.block_no = uf2_blocks_written++;
                 assert(size <= PAGE_SIZE);
                 memcpy(block.data, buffer, size);
                 if (size < PAGE_SIZE) memset(block.data + size, 0, PAGE_SIZE - size);
@@ -5039,21 +6239,65 @@ bool save_command::execute(device_map &devices) {
     if (out) {
         try {
             vector<uint8_t> buf;
+            uint32_t blank_sectors = 0;
             {
                 progress_bar bar("Saving file: ");
                 for (uint32_t addr = start; addr < end; addr += chunk_size) {
                     bar.progress(addr-start, end-start);
                     uint32_t this_chunk_size = std::min(chunk_size, end - addr);
-                    raw_access.read_into_vector(addr, this_chunk_size, buf);
+                    vector<bool> blank;
+                    if (skip_blank && raw_access.read_flash_blank(addr, this_chunk_size / FLASH_SECTOR_ERASE_SIZE, blank)) {
+                        // only read the runs of sectors which aren't blank
+                        buf.assign(this_chunk_size, 0xff);
+                        for (uint32_t offset = 0; offset < this_chunk_size;) {
+                            if (blank[offset / FLASH_SECTOR_ERASE_SIZE]) {
+                                offset += FLASH_SECTOR_ERASE_SIZE;
+                                continue;
+                            }
+                            uint32_t run_end = offset + FLASH_SECTOR_ERASE_SIZE;
+                            while (run_end < this_chunk_size && !blank[run_end / FLASH_SECTOR_ERASE_SIZE]) {
+                                run_end += FLASH_SECTOR_ERASE_SIZE;
+                            }
+                            raw_access.read(addr + offset, buf.data() + offset, run_end - offset, false);
+                            offset = run_end;
+                        }
+                    } else {
+                        raw_access.read_into_vector(addr, this_chunk_size, buf);
+                        if (skip_blank) {
+                            for (uint32_t offset = 0; offset < this_chunk_size; offset += FLASH_SECTOR_ERASE_SIZE) {
+                                blank.push_back(std::all_of(buf.cbegin() + offset, buf.cbegin() + offset + FLASH_SECTOR_ERASE_SIZE,
+                                                            [](uint8_t b) { return b == 0xff; }));
+                            }
+                        }
+                    }
+                    blank_sectors += std::count(blank.cbegin(), blank.cend(), true);
                     uint32_t remaining_size = this_chunk_size;
                     while (remaining_size) {
                         uint32_t this_size = std::min(PAGE_SIZE, remaining_size);
-                        writer256(out, buf.data() + (this_chunk_size - remaining_size), this_size, addr - start + (this_chunk_size - remaining_size));
+                        uint32_t offset = this_chunk_size - remaining_size;
+                        // BIN files must still contain the 0xff data, as holes in a sparse file would read back as zeros
+                        if (blank.empty() || !blank[offset / FLASH_SECTOR_ERASE_SIZE] || get_file_type() != filetype::uf2) {
+                            writer256(out, buf.data() + offset, this_size, addr - start + offset);
+                        }
                         remaining_size -= this_size;
                     }
                 }
                 bar.progress(100);
             }
+            if (get_file_type() == filetype::uf2 && uf2_blocks_written != block.num_blocks) {
+                // blocks were left out, so correct the block count in the ones that were written
+                for (uint32_t i = 0; i < uf2_blocks_written; i++) {
+                    fseek(out, (long)(i * sizeof(uf2_block) + offsetof(uf2_block, num_blocks)), SEEK_SET);
+                    if (1 != fwrite(&uf2_blocks_written, sizeof(uf2_blocks_written), 1, out)) {
+                        fail_write_error();
+                    }
+                }
+            }
+            if (blank_sectors) {
+                std::cout << "  " << blank_sectors << " of " << size / FLASH_SECTOR_ERASE_SIZE << " sectors were blank";
+                if (get_file_type() == filetype::uf2) std::cout << ", and were left out of the file";
+                std::cout << "\n";
+            }
             fseek(out, 0, SEEK_END);
             std::cout << "Wrote " << ftell(out) << " bytes to " << settings.filenames[0].c_str() << "\n";
             fclose(out);
@@ -5068,13 +6312,13 @@ bool save_command::execute(device_map &devices) {
         auto file_access = get_file_memory_access(0);
         model_t model = raw_access.get_model();
         auto ranges = get_coalesced_ranges(file_access, model);
+        raw_access.enable_device_crcs = can_use_device_crcs(ranges, model);
         for (auto mem_range : ranges) {
             enum memory_type type = get_memory_type(mem_range.from, model);
             bool ok = true;
             {
                 progress_bar bar("Verifying " + memory_names[type] + ": ");
                 vector<uint8_t> file_buf;
-                vector<uint8_t> device_buf;
                 uint32_t pos = mem_range.from;
                 for (uint32_t base = mem_range.from; base < mem_range.to && ok; base += chunk_size) {
                     uint32_t this_batch = std::min(std::min(mem_range.to, end) - base, chunk_size);
@@ -5082,18 +6326,12 @@ bool save_command::execute(device_map &devices) {
                     // mean that the verification will fail if those holes are not filled with zeros
                     // on the device
                     file_access.read_into_vector(base, this_batch, file_buf, true);
-                    raw_access.read_into_vector(base, this_batch, device_buf);
-                    assert(file_buf.size() == device_buf.size());
-                    for (unsigned int i = 0; i < this_batch; i++) {
-                        if (file_buf[i] != device_buf[i]) {
-                            pos = base + i;
-                            printf("Unmatch file %x, device %x, pos %x\n", file_buf[i], device_buf[i], pos);
-                            ok = false;
-                            break;
-                        }
-                    }
-                    if (ok) {
-                        pos = base + this_batch;
+                    pos = find_device_mismatch(raw_access, base, file_buf);
+                    if (pos != base + this_batch) {
+                        uint8_t device_byte;
+                        raw_access.read(pos, &device_byte, 1, false);
+                        printf("Unmatch file %x, device %x, pos %x\n", file_buf[pos - base], device_byte, pos);
+                        ok = false;
                     }
                     bar.progress(pos - mem_range.from, mem_range.to - mem_range.from);
                 }
@@ -5155,6 +6393,7 @@ bool erase_command::execute(device_map &devices) {
             fail(ERROR_ARGS, "Erase range is invalid/empty");
         }
     } else {
+        raw_access.enable_flash_probe = true;
         end = FLASH_START + guess_flash_size(raw_access);
         if (end <= FLASH_START) {
             fail(ERROR_NOT_POSSIBLE, "Cannot determine the flash size, so cannot erase the entirety of flash, try --range.");
@@ -5170,10 +6409,11 @@ bool erase_command::execute(device_map &devices) {
 
     {
         progress_bar bar("Erasing: ");
+        raw_access.flash_changed();
         con.exit_xip();
-        for (uint32_t addr = start; addr < end; addr += FLASH_SECTOR_ERASE_SIZE) {
-            bar.progress(addr-start, end-start);
-            con.flash_erase(addr, FLASH_SECTOR_ERASE_SIZE);
+        for (const auto &e : plan_flash_erase(range(start, end), raw_access.can_block_erase())) {
+            bar.progress(e.from - start, end - start);
+            con.flash_erase(e.from, e.len());
         }
         bar.progress(100);
     }
@@ -5214,12 +6454,49 @@ bool get_target_partition(picoboot::connection &con, uint32_t* start = nullptr,
     }
 }
 
+// Queue writes of the pages of data (len bytes, page aligned) to freshly erased flash at addr, leaving out runs of
+// pages which are all 0xff, as the flash is already 0xff there. Returns the number of commands queued, and adds the
+// number of bytes left out to skipped.
+static unsigned int write_erased_flash_async(picoboot::connection &con, uint32_t addr, uint8_t *data, uint32_t len,
+                                             uint32_t &skipped) {
+    assert(is_size_aligned(addr, PAGE_SIZE) && is_size_aligned(len, PAGE_SIZE));
+    auto blank_run_end = [&](uint32_t offset) {
+        while (offset < len && std::all_of(data + offset, data + offset + PAGE_SIZE, [](uint8_t b) { return b == 0xff; })) {
+            offset += PAGE_SIZE;
+        }
+        return offset;
+    };
+    unsigned int num_cmds = 0;
+    uint32_t from = 0;
+    for (uint32_t offset = 0; offset < len;) {
+        uint32_t blank_end = blank_run_end(offset);
+        if (blank_end - offset >= FLASH_BLANK_SKIP_MIN || (blank_end == len && blank_end > offset)) {
+            if (offset > from) {
+                con.write_async(addr + from, data + from, offset - from);
+                num_cmds++;
+            }
+            skipped += blank_end - offset;
+            from = blank_end;
+            offset = blank_end;
+        } else {
+            offset = blank_end + PAGE_SIZE;
+        }
+    }
+    if (len > from) {
+        con.write_async(addr + from, data + from, len - from);
+        num_cmds++;
+    }
+    return num_cmds;
+}
+
 bool load_guts(picoboot::connection con, iostream_memory_access &file_access) {
     picoboot_memory_access raw_access(con);
     range flash_binary_range(FLASH_START, FLASH_END_RP2350); // pick biggest (rp2350) here for now
     bool flash_binary_end_unknown = true;
-    if (settings.load.no_overwrite_force) settings.load.no_overwrite = true;
-    if (settings.load.no_overwrite) {
+    // a local copy, as several devices may be loaded in parallel from worker threads
+    auto load = settings.load;
+    if (load.no_overwrite_force) load.no_overwrite = true;
+    if (load.no_overwrite) {
         binary_info_header hdr;
         if (find_binary_info(raw_access, hdr)) {
             auto access = remapped_memory_access(raw_access, hdr.reverse_copy_mapping);
@@ -5252,9 +6529,9 @@ bool load_guts(picoboot::connection con, iostream_memory_access &file_access) {
             flash_min = std::min(flash_min, mem_range.from);
             flash_max = std::max(flash_max, mem_range.to);
         }
-        if (settings.load.no_overwrite && mem_range.intersects(flash_binary_range)) {
+        if (load.no_overwrite && mem_range.intersects(flash_binary_range)) {
             if (flash_binary_end_unknown) {
-                if (!settings.load.no_overwrite_force) {
+                if (!load.no_overwrite_force) {
                     fail(ERROR_NOT_POSSIBLE, "-n option specified, but the size/presence of an existing flash binary could not be detected; aborting. Consider using the -N option");
                 }
             } else {
@@ -5268,6 +6545,8 @@ bool load_guts(picoboot::connection con, iostream_memory_access &file_access) {
         uint32_t flash_data_size = flash_max - flash_min;
         assert(flash_min >= FLASH_START);
         uint32_t flash_start_offset = flash_min - FLASH_START;
+        // nothing has been loaded yet, so XIP SRAM can be used to probe the flash
+        raw_access.enable_flash_probe = true;
         uint32_t size_guess = guess_flash_size(raw_access);
         if (size_guess > 0) {
             // Skip check when targeting PSRAM, which is anything above 0x11000000
@@ -5284,92 +6563,227 @@ bool load_guts(picoboot::connection con, iostream_memory_access &file_access) {
                 fail(ERROR_NOT_POSSIBLE, "File size 0x%x is too big to fit in partition size 0x%x", flash_data_size, settings.partition_size);
             }
         }
+        raw_access.flash_changed();
     }
+    // The load is pipelined: the erase, program and (if verifying) read back of each batch are queued on the
+    // connection without waiting, and a batch is only checked once the next one has been queued. This means the
+    // file data for batch N+1 is prepared, and the read back of batch N compared, while the device is still busy.
+    struct load_batch {
+        range device_range;
+        vector<uint8_t> file_buf;
+        const uint8_t *file_data = nullptr; // either file_buf, or straight from file_access
+        vector<uint8_t> device_buf;
+        std::deque<vector<uint8_t>> device_images; // sent by program_flash_compressed
+        unsigned int num_cmds = 0;
+    };
+    raw_access.enable_device_crcs = can_use_device_crcs(ranges, model);
+    raw_access.enable_compressed_flash = can_use_compressed_flash(ranges, model);
     for (auto mem_range : ranges) {
         enum memory_type type = get_memory_type(mem_range.from, model);
+        bool ok = true;
+        uint32_t pos = mem_range.from;
+        // flash may be verified by CRCs calculated on the device once it has all been loaded, rather than reading
+        // back each batch
+        bool crc_verify = load.verify && raw_access.can_read_flash_crcs(mem_range.from, mem_range.len());
+        // when updating, compare sector CRCs calculated on the device against the file where possible, rather than
+        // reading back the existing contents
+        range crc_range(mem_range.from & ~(FLASH_SECTOR_ERASE_SIZE - 1),
+                        (mem_range.to + FLASH_SECTOR_ERASE_SIZE - 1) & ~(FLASH_SECTOR_ERASE_SIZE - 1));
+        vector<uint32_t> device_crcs;
+        bool crc_update = load.update && type == flash &&
+                          raw_access.read_flash_crcs(crc_range.from, crc_range.len() / FLASH_SECTOR_ERASE_SIZE, device_crcs);
+        uint32_t skipped_sectors = 0;
+        uint32_t total_sectors = 0;
+        uint32_t blank_bytes = 0;
+        uint32_t compressed_bytes = 0;
+        uint32_t compressed_sent = 0;
         // new scope for progress bar
         {
             progress_bar bar("Loading into " + memory_names[type] + ": ");
             // Use batches of size/100 rounded up to FLASH_SECTOR_ERASE_SIZE
             uint32_t batch_size = calculate_chunk_size(mem_range.len());
-            bool ok = true;
-            vector<uint8_t> file_buf;
-            vector<uint8_t> device_buf;
-            for (uint32_t base = mem_range.from; base < mem_range.to && ok;) {
-                uint32_t this_batch = std::min(mem_range.to - base, batch_size);
-                if (type == flash) {
-                    // we have to erase an entire page, so then fill with zeros
-                    range aligned_range(base & ~(FLASH_SECTOR_ERASE_SIZE - 1),
-                                        (base + this_batch + FLASH_SECTOR_ERASE_SIZE - 1) & ~(FLASH_SECTOR_ERASE_SIZE - 1));
-                    range read_range(base, base + this_batch);
-                    read_range.intersect(aligned_range);
-                    file_access.read_into_vector(read_range.from, read_range.to - read_range.from, file_buf, true); // zero fill to cope with holes
-                    // zero padding up to batch_size
-                    file_buf.insert(file_buf.begin(), read_range.from - aligned_range.from, 0);
-                    file_buf.insert(file_buf.end(), aligned_range.to - read_range.to, 0);
-                    assert(file_buf.size() == aligned_range.len());
-
-                    bool skip = false;
-                    if (settings.load.update) {
+            std::deque<load_batch> in_flight;
+            auto retire = [&](size_t max_batches) {
+                while (in_flight.size() > max_batches) {
+                    unsigned int younger_cmds = 0;
+                    for (auto b = in_flight.begin() + 1; b != in_flight.end(); b++) {
+                        younger_cmds += b->num_cmds;
+                    }
+                    con.flush(younger_cmds);
+                    auto &b = in_flight.front();
+                    if (ok && !b.device_buf.empty()) {
+                        assert(b.device_range.len() == b.device_buf.size());
+                        auto mismatch = std::mismatch(b.device_buf.cbegin(), b.device_buf.cend(), b.file_data);
+                        if (mismatch.first != b.device_buf.cend()) {
+                            pos = b.device_range.from + (mismatch.first - b.device_buf.cbegin());
+                            ok = false;
+                        } else {
+                            pos = b.device_range.to;
+                        }
+                    }
+                    in_flight.pop_front();
+                }
+            };
+            if (type == flash) con.exit_xip();
+            try {
+                // stop queuing batches once a read back has mismatched; at most the one batch already queued behind it
+                // is written after that
+                for (uint32_t base = mem_range.from; base < mem_range.to && ok;) {
+                    in_flight.emplace_back();
+                    auto &b = in_flight.back();
+                    if (type == flash) {
+                        // end the batch on a sector boundary, so the next batch doesn't erase this one's last sector
+                        uint32_t batch_end = std::min(mem_range.to, (base & ~(FLASH_SECTOR_ERASE_SIZE - 1)) + batch_size);
+                        // we have to erase an entire page, so then fill with zeros
+                        range aligned_range(base & ~(FLASH_SECTOR_ERASE_SIZE - 1),
+                                            (batch_end + FLASH_SECTOR_ERASE_SIZE - 1) & ~(FLASH_SECTOR_ERASE_SIZE - 1));
+                        range read_range(base, batch_end);
+                        // zero padding up to batch_size
+                        b.file_buf.assign(aligned_range.len(), 0);
+                        file_access.read(read_range.from, b.file_buf.data() + (read_range.from - aligned_range.from), read_range.len(), true); // zero fill to cope with holes
+                        b.file_data = b.file_buf.data();
+                        b.device_range = aligned_range;
+
                         vector<uint8_t> read_device_buf;
-                        raw_access.read_into_vector(aligned_range.from, file_buf.size(), read_device_buf);
-                        skip = file_buf == read_device_buf;
+                        if (load.update && !crc_update) {
+                            raw_access.read_into_vector(aligned_range.from, b.file_buf.size(), read_device_buf);
+                        }
+                        auto unchanged = [&](uint32_t offset) {
+                            if (!load.update) return false;
+                            if (crc_update) {
+                                uint32_t sector = (aligned_range.from + offset - crc_range.from) / FLASH_SECTOR_ERASE_SIZE;
+                                return crc32_sw(b.file_buf.data() + offset, FLASH_SECTOR_ERASE_SIZE, 0xffffffff) == device_crcs[sector];
+                            }
+                            return std::equal(b.file_buf.cbegin() + offset, b.file_buf.cbegin() + offset + FLASH_SECTOR_ERASE_SIZE,
+                                              read_device_buf.cbegin() + offset);
+                        };
+                        auto erase_and_write = [&](uint32_t from, uint32_t to) {
+                            con.exit_xip();
+                            for (const auto &e : plan_flash_erase(range(aligned_range.from + from, aligned_range.from + to),
+                                                                  raw_access.can_block_erase())) {
+                                con.flash_erase_async(e.from, e.len());
+                                b.num_cmds++;
+                            }
+                            b.num_cmds += write_erased_flash_async(con, aligned_range.from + from, b.file_buf.data() + from,
+                                                                   to - from, blank_bytes);
+                        };
+                        // the length of the block which will be programmed after the one ending at to (an offset in this
+                        // batch, within the run ending at run_end) if known, so the device can start erasing it early
+                        auto next_block_len = [&](uint32_t to, uint32_t run_end) -> uint32_t {
+                            uint32_t next = aligned_range.from + to;
+                            uint32_t next_end;
+                            if (to < run_end) {
+                                next_end = aligned_range.from + run_end;
+                            } else if (to == b.file_buf.size() && !load.update && !(load.verify && !crc_verify) &&
+                                       aligned_range.to < mem_range.to) {
+                                // nothing is read from the flash between batches, and the next one is all programmed
+                                next_end = (std::min(mem_range.to, next + batch_size) + FLASH_SECTOR_ERASE_SIZE - 1) &
+                                           ~(FLASH_SECTOR_ERASE_SIZE - 1);
+                            } else {
+                                return 0;
+                            }
+                            return std::min(next_end, (next / FLASH_COMPRESSED_BATCH_SIZE + 1) * FLASH_COMPRESSED_BATCH_SIZE) - next;
+                        };
+                        // erase and program each run of changed sectors
+                        for (uint32_t offset = 0; offset < b.file_buf.size();) {
+                            if (unchanged(offset)) {
+                                skipped_sectors++;
+                                offset += FLASH_SECTOR_ERASE_SIZE;
+                                continue;
+                            }
+                            uint32_t run_end = offset + FLASH_SECTOR_ERASE_SIZE;
+                            while (run_end < b.file_buf.size() && !unchanged(run_end)) {
+                                run_end += FLASH_SECTOR_ERASE_SIZE;
+                            }
+                            if (raw_access.can_program_flash_compressed()) {
+                                // send the data compressed where it helps, in blocks which the device can expand
+                                for (uint32_t from = offset; from < run_end;) {
+                                    uint32_t block_end = ((aligned_range.from + from) / FLASH_COMPRESSED_BATCH_SIZE + 1) *
+                                                         FLASH_COMPRESSED_BATCH_SIZE - aligned_range.from;
+                                    uint32_t to = std::min(run_end, block_end);
+                                    if (raw_access.program_flash_compressed(aligned_range.from + from, b.file_buf.data() + from,
+                                                                            to - from, next_block_len(to, run_end),
+                                                                            b.device_images, b.num_cmds)) {
+                                        compressed_bytes += to - from;
+                                        compressed_sent += b.device_images.back().size();
+                                    } else {
+                                        erase_and_write(from, to);
+                                    }
+                                    from = to;
+                                }
+                            } else {
+                                erase_and_write(offset, run_end);
+                            }
+                            offset = run_end;
+                        }
+                        total_sectors += b.file_buf.size() / FLASH_SECTOR_ERASE_SIZE;
+                        base = read_range.to;
+                    } else {
+                        uint32_t this_batch = std::min(mem_range.to - base, batch_size);
+                        // no padding is needed, so send the file data without copying it where possible
+                        b.file_data = file_access.span(base, this_batch);
+                        if (!b.file_data) {
+                            file_access.read_into_vector(base, this_batch, b.file_buf);
+                            b.file_data = b.file_buf.data();
+                        }
+                        b.device_range = range(base, base + this_batch);
+                        con.write_async(base, const_cast<uint8_t *>(b.file_data), this_batch);
+                        b.num_cmds++;
+                        base += this_batch;
                     }
-                    if (!skip) {
-                        con.exit_xip();
-                        con.flash_erase(aligned_range.from, file_buf.size());
-                        raw_access.write_vector(aligned_range.from, file_buf);
+                    if (load.verify && !crc_verify) {
+                        b.device_buf.resize(b.device_range.len());
+                        con.read_async(b.device_range.from, b.device_buf.data(), b.device_buf.size());
+                        b.num_cmds++;
                     }
-                    base = read_range.to; // about to add batch_size
-                } else {
-                    file_access.read_into_vector(base, this_batch, file_buf);
-                    raw_access.write_vector(base, file_buf);
-                    base += this_batch;
+                    // keep one batch queued behind the one being checked
+                    retire(1);
+                    bar.progress(base - mem_range.from, mem_range.to - mem_range.from);
                 }
-                bar.progress(base - mem_range.from, mem_range.to - mem_range.from);
+                retire(0);
+            } catch (std::exception &) {
+                // the queued commands still reference the batch buffers
+                try {
+                    con.flush();
+                } catch (std::exception &) {}
+                throw;
             }
         }
-    }
-    for (auto mem_range : ranges) {
-        enum memory_type type = get_memory_type(mem_range.from, model);
-        if (settings.load.verify) {
-            bool ok = true;
+        if (load.update && type == flash) {
+            load_output() << "  " << skipped_sectors << " of " << total_sectors << " sectors were unchanged and skipped\n";
+        }
+        if (blank_bytes) {
+            if (settings.verbose) load_output() << "  " << blank_bytes << " bytes of 0xff were left erased rather than programmed\n";
+        }
+        if (compressed_bytes) {
+            if (settings.verbose) load_output() << "  " << compressed_bytes << " bytes were sent compressed as " << compressed_sent << " bytes\n";
+        }
+        if (load.verify) {
             {
                 progress_bar bar("Verifying " + memory_names[type] + ": ");
-                uint32_t batch_size = calculate_chunk_size(mem_range.len());
-                vector<uint8_t> file_buf;
-                vector<uint8_t> device_buf;
-                uint32_t pos = mem_range.from;
-                for (uint32_t base = mem_range.from; base < mem_range.to && ok; base += batch_size) {
-                    uint32_t this_batch = std::min(mem_range.to - base, batch_size);
-                    // note we pass zero_fill = true in case the file has holes, but this does
-                    // mean that the verification will fail if those holes are not filled with zeros
-                    // on the device
-                    file_access.read_into_vector(base, this_batch, file_buf, true);
-                    raw_access.read_into_vector(base, this_batch, device_buf);
-                    assert(file_buf.size() == device_buf.size());
-                    for (unsigned int i = 0; i < this_batch; i++) {
-                        if (file_buf[i] != device_buf[i]) {
-                            pos = base + i;
-                            ok = false;
-                            break;
-                        }
-                    }
-                    if (ok) {
-                        pos = base + this_batch;
+                if (crc_verify) {
+                    vector<uint8_t> file_buf;
+                    uint32_t batch_size = calculate_chunk_size(mem_range.len());
+                    for (uint32_t base = mem_range.from; base < mem_range.to && ok; base += batch_size) {
+                        uint32_t this_batch = std::min(mem_range.to - base, batch_size);
+                        file_access.read_into_vector(base, this_batch, file_buf, true);
+                        pos = find_device_mismatch(raw_access, base, file_buf);
+                        ok = pos == base + this_batch;
+                        bar.progress(pos - mem_range.from, mem_range.to - mem_range.from);
                     }
-                    bar.progress(pos - mem_range.from, mem_range.to - mem_range.from);
                 }
+                bar.progress(mem_range.clamp(pos) - mem_range.from, mem_range.to - mem_range.from);
             }
             if (ok) {
-                std::cout << "  OK\n";
+                load_output() << "  OK\n";
             } else {
-                std::cout << "  FAILED\n";
+                load_output() << "  FAILED\n";
                 fail(ERROR_VERIFICATION_FAILED, "The device contents did not match the file");
             }
         }
     }
-    if (settings.load.execute) {
+    raw_access.clear_cache();
+    if (load.execute) {
         uint32_t start = file_access.get_binary_start();
         if (!start) {
             fail(ERROR_FORMAT, "Cannot execute as file does not contain a valid RP2 executable image");
@@ -5404,15 +6818,15 @@ bool load_guts(picoboot::connection con, iostream_memory_access &file_access) {
             con.reboot(flash == get_memory_type(start, model) ? 0 : start,
                        model->sram_end(), 500);
         }
-        std::cout << "\nThe device was rebooted to start the application.\n";
+        load_output() << "\nThe device was rebooted to start the application.\n";
         return true;
     }
     return false;
 }
 
-bool load_command::execute(device_map &devices) {
-    auto con = get_single_bootsel_device_connection(devices);
-    picoboot_memory_access raw_access(con);
+// Work out where in flash to load the file on this device (updating settings.offset etc.), which may depend on its
+// partition table
+static void set_load_target(picoboot::connection &con, picoboot_memory_access &raw_access) {
     auto tmp_file_access = get_file_memory_access(0);
     if (settings.load.partition >= 0) {
         auto partitions = get_partitions(con);
@@ -5450,10 +6864,126 @@ bool load_command::execute(device_map &devices) {
             }
         }
     }
-    auto file_access = get_file_memory_access(0);
     if (settings.offset_set && get_file_type() != filetype::bin && raw_access.get_model()->chip() == rp2040) {
         fail(ERROR_ARGS, "Offset only valid for BIN files");
     }
+}
+
+// load --all-devices: the file is decoded once into a buffer shared by all the devices, which are then each loaded
+// on their own thread with their own connection
+static bool load_all_devices(device_map &devices) {
+    auto &targets = devices[dr_vidpid_bootrom_ok];
+    assert(!targets.empty());
+    selected_chip = std::get<0>(targets[0]);
+    // The load target comes from each device's partition table, but the file is only decoded once, so it must be the
+    // same for all of them
+    auto load_target = [] { return std::make_tuple(settings.offset, settings.offset_set, settings.partition_size, settings.family_id); };
+    const auto original_target = load_target();
+    auto target = original_target;
+    model_t model;
+    for (size_t i = 0; i < targets.size(); i++) {
+        libusb_device_handle *handle = std::get<2>(targets[i]);
+        if (!handle) fail(ERROR_USB, "Unable to connect to %s", bus_device_string(std::get<1>(targets[i]), std::get<0>(targets[i])).c_str());
+        std::tie(settings.offset, settings.offset_set, settings.partition_size, settings.family_id) = original_target;
+        picoboot::connection con(handle);
+        picoboot_memory_access raw_access(con);
+        set_load_target(con, raw_access);
+        if (!i) {
+            target = load_target();
+            model = raw_access.get_model();
+        } else if (load_target() != target) {
+            fail(ERROR_NOT_POSSIBLE, "The devices do not all have the same load target (partition layout), so must be loaded individually");
+        }
+    }
+
+    auto file_access = get_file_memory_access(0);
+    file_access.read_all();
+    // one progress bar per range loaded, plus one per range verified
+    int bars_per_device = (int)get_coalesced_ranges(file_access, model).size() * (settings.load.verify ? 2 : 1);
+
+    struct device_result {
+        device_load_status status;
+        std::string error;
+        int error_code = 0;
+        bool rebooted = false;
+    };
+    vector<std::unique_ptr<device_result>> results;
+    vector<std::thread> threads;
+    for (auto &t : targets) {
+        results.emplace_back(new device_result());
+        device_result *result = results.back().get();
+        libusb_device_handle *handle = std::get<2>(t);
+        threads.emplace_back([&file_access, result, handle] {
+            thread_load_status = &result->status;
+            try {
+                picoboot::connection con(handle);
+                iostream_memory_access device_file_access(file_access); // shares the data read above
+                result->rebooted = load_guts(con, device_file_access);
+            } catch (failure_error &e) {
+                result->error = e.what();
+                result->error_code = e.code();
+            } catch (picoboot::command_failure &e) {
+                result->error = string("The device returned an error: ") + e.what();
+                result->error_code = ERROR_UNKNOWN;
+            } catch (picoboot::connection_error &) {
+                result->error = "Communication with the device failed";
+                result->error_code = ERROR_CONNECTION;
+            } catch (std::exception &e) {
+                result->error = e.what();
+                result->error_code = ERROR_UNKNOWN;
+            }
+            std::lock_guard<std::mutex> lock(result->status.mutex);
+            result->status.done = true;
+        });
+    }
+    {
+        progress_bar bar("Loading devices: ");
+        bool all_done;
+        do {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            all_done = true;
+            long total = 0;
+            for (auto &r : results) {
+                std::lock_guard<std::mutex> lock(r->status.mutex);
+                all_done &= r->status.done;
+                total += r->status.done ? 100 : std::min(100, (r->status.bars_finished * 100 + r->status.percent) / std::max(1, bars_per_device));
+            }
+            bar.progress(total, (long)(100 * results.size()));
+        } while (!all_done);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    int failures = 0;
+    int error_code = 0;
+    bool rebooted = false;
+    for (size_t i = 0; i < targets.size(); i++) {
+        auto &r = results[i];
+        std::cout << bus_device_string(std::get<1>(targets[i]), std::get<0>(targets[i])) << ": ";
+        if (r->error.empty()) {
+            std::cout << "OK\n";
+        } else {
+            std::cout << "FAILED: " << r->error << "\n";
+            if (!failures++) error_code = r->error_code;
+        }
+        std::cout << r->status.output.str();
+        rebooted |= r->rebooted;
+    }
+    if (failures) {
+        fail(error_code, "Loading failed on %d of %d devices", failures, (int)targets.size());
+    }
+    return rebooted;
+}
+
+bool load_command::execute(device_map &devices) {
+    if (settings.load.all_devices) {
+        return load_all_devices(devices);
+    }
+    auto con = get_single_bootsel_device_connection(devices);
+    picoboot_memory_access raw_access(con);
+    set_load_target(con, raw_access);
+    auto file_access = get_file_memory_access(0);
     bool ret = load_guts(con, file_access);
     return ret;
 }
@@ -5481,11 +7011,24 @@ uint32_t __noinline otp_calculate_ecc(uint16_t x) {
 
 
 #if HAS_MBEDTLS
-void sign_guts_elf(elf_file* elf, private_t private_key, public_t public_key, model_t model) {
+// The hash and signature added to an image by seal or encrypt
+struct seal_result {
+    seal_result() = default;
+    explicit seal_result(block &sealed_block) {
+        auto hash = sealed_block.get_item<hash_value_item>();
+        if (hash != nullptr) hash_bytes = hash->hash_bytes;
+        auto signature = sealed_block.get_item<signature_item>();
+        if (signature != nullptr) signature_bytes = signature->signature_bytes;
+    }
+
+    vector<uint8_t> hash_bytes;
+    vector<uint8_t> signature_bytes;
+};
+
+void sign_guts_elf(elf_file* elf, private_t private_key, public_t public_key, model_t model, uint32_t family_id, _settings::seal_settings seal, seal_result *result = nullptr) {
     std::unique_ptr<block> first_block = find_first_block(elf);
     if (!first_block) {
         // Throw a clearer error for RP2040 binaries with no block loop
-        auto family_id = get_family_id(0);
         if (family_id == RP2040_FAMILY_ID) {
             fail(ERROR_FORMAT, "No metadata block found when sealing RP2040 binary - either use RP2350, or set PICO_CRT0_INCLUDE_PICOBIN_BLOCK=1");
         } else {
@@ -5494,36 +7037,36 @@ void sign_guts_elf(elf_file* elf, private_t private_key, public_t public_key, mo
     }
 
     // Workaround RP2350-E13, which means when using rollback versions, all other blocks must be set as ignored
-    block new_block = place_new_block(elf, first_block, model, settings.seal.rollback_version);
+    block new_block = place_new_block(elf, first_block, model, seal.rollback_version);
 
-    if (settings.seal.set_tbyb) {
+    if (seal.set_tbyb) {
         // Set the TBYB bit on the image_type_item
         std::shared_ptr<image_type_item> image_type = new_block.get_item<image_type_item>();
         image_type->flags |= PICOBIN_IMAGE_TYPE_EXE_TBYB_BITS;
     }
 
-    if (settings.seal.major_version || settings.seal.minor_version || settings.seal.rollback_version) {
+    if (seal.major_version || seal.minor_version || seal.rollback_version) {
         std::shared_ptr<version_item> version = new_block.get_item<version_item>();
         if (version != nullptr) {
             // Use existing major and minor versions, if not being overridden
-            if (settings.seal.major_version == 0) settings.seal.major_version = version->major;
-            if (settings.seal.minor_version == 0) settings.seal.minor_version = version->minor;
+            if (seal.major_version == 0) seal.major_version = version->major;
+            if (seal.minor_version == 0) seal.minor_version = version->minor;
             new_block.items.erase(std::find(new_block.items.begin(), new_block.items.end(), version));
         }
-        if (settings.seal.rollback_version) {
-            if (!settings.seal.sign) {
+        if (seal.rollback_version) {
+            if (!seal.sign) {
                 fail(ERROR_INCOMPATIBLE, "You must sign the binary if adding a rollback version");
             }
-            version = std::make_shared<version_item>(settings.seal.major_version, settings.seal.minor_version, settings.seal.rollback_version, settings.seal.rollback_rows);
+            version = std::make_shared<version_item>(seal.major_version, seal.minor_version, seal.rollback_version, seal.rollback_rows);
         } else {
-            version = std::make_shared<version_item>(settings.seal.major_version, settings.seal.minor_version);
+            version = std::make_shared<version_item>(seal.major_version, seal.minor_version);
         }
         new_block.items.push_back(version);
     }
 
     // Add entry point and vector table when signing Arm images, and set PICOBIN_IMAGE_TYPE_EXE_EXTRA_SECURITY_BITS
     std::shared_ptr<image_type_item> image_type = new_block.get_item<image_type_item>();
-    if (settings.seal.sign && image_type != nullptr && image_type->image_type() == type_exe && image_type->cpu() == cpu_arm) {
+    if (seal.sign && image_type != nullptr && image_type->image_type() == type_exe && image_type->cpu() == cpu_arm) {
         // Set PICOBIN_IMAGE_TYPE_EXE_EXTRA_SECURITY_BITS
         image_type->flags |= PICOBIN_IMAGE_TYPE_EXE_EXTRA_SECURITY_BITS;
         std::shared_ptr<entry_point_item> entry_point = new_block.get_item<entry_point_item>();
@@ -5567,18 +7110,18 @@ void sign_guts_elf(elf_file* elf, private_t private_key, public_t public_key, mo
     hash_andor_sign(
         elf, &new_block, public_key, private_key,
         model,
-        settings.seal.hash, settings.seal.sign,
-        settings.seal.clear_sram, settings.seal.pin_xip_sram
+        seal.hash, seal.sign,
+        seal.clear_sram, seal.pin_xip_sram
     );
+    if (result) *result = seal_result(new_block);
 }
 
-vector<uint8_t> sign_guts_bin(iostream_memory_access in, private_t private_key, public_t public_key, uint32_t bin_start, uint32_t bin_size, model_t model) {
+vector<uint8_t> sign_guts_bin(iostream_memory_access in, private_t private_key, public_t public_key, uint32_t bin_start, uint32_t bin_size, model_t model, uint32_t family_id, _settings::seal_settings seal, seal_result *result = nullptr) {
     vector<uint8_t> bin = in.read_vector<uint8_t>(bin_start, bin_size, false);
 
     std::unique_ptr<block> first_block = find_first_block(bin, bin_start);
     if (!first_block) {
         // Throw a clearer error for RP2040 binaries with no block loop
-        auto family_id = get_family_id(0);
         if (family_id == RP2040_FAMILY_ID) {
             fail(ERROR_FORMAT, "No metadata block found when sealing RP2040 binary - either use RP2350, or set PICO_CRT0_INCLUDE_PICOBIN_BLOCK");
         } else {
@@ -5587,30 +7130,30 @@ vector<uint8_t> sign_guts_bin(iostream_memory_access in, private_t private_key,
     }
 
     // Workaround RP2350-E13, which means when using rollback versions, all other blocks must be set as ignored
-    block new_block = place_new_block(bin, bin_start, first_block, model, settings.seal.rollback_version);
+    block new_block = place_new_block(bin, bin_start, first_block, model, seal.rollback_version);
 
-    if (settings.seal.major_version || settings.seal.minor_version || settings.seal.rollback_version) {
+    if (seal.major_version || seal.minor_version || seal.rollback_version) {
         std::shared_ptr<version_item> version = new_block.get_item<version_item>();
         if (version != nullptr) {
             // Use existing major and minor versions, if not being overridden
-            if (settings.seal.major_version == 0) settings.seal.major_version = version->major;
-            if (settings.seal.minor_version == 0) settings.seal.minor_version = version->minor;
+            if (seal.major_version == 0) seal.major_version = version->major;
+            if (seal.minor_version == 0) seal.minor_version = version->minor;
             new_block.items.erase(std::find(new_block.items.begin(), new_block.items.end(), version));
         }
-        if (settings.seal.rollback_version) {
-            if (!settings.seal.sign) {
+        if (seal.rollback_version) {
+            if (!seal.sign) {
                 fail(ERROR_INCOMPATIBLE, "You must sign the binary if adding a rollback version");
             }
-            version = std::make_shared<version_item>(settings.seal.major_version, settings.seal.minor_version, settings.seal.rollback_version, settings.seal.rollback_rows);
+            version = std::make_shared<version_item>(seal.major_version, seal.minor_version, seal.rollback_version, seal.rollback_rows);
         } else {
-            version = std::make_shared<version_item>(settings.seal.major_version, settings.seal.minor_version);
+            version = std::make_shared<version_item>(seal.major_version, seal.minor_version);
         }
         new_block.items.push_back(version);
     }
 
     // Add entry point and vector table when signing Arm images, and set PICOBIN_IMAGE_TYPE_EXE_EXTRA_SECURITY_BITS
     std::shared_ptr<image_type_item> image_type = new_block.get_item<image_type_item>();
-    if (settings.seal.sign && image_type != nullptr && image_type->image_type() == type_exe && image_type->cpu() == cpu_arm) {
+    if (seal.sign && image_type != nullptr && image_type->image_type() == type_exe && image_type->cpu() == cpu_arm) {
         // Set PICOBIN_IMAGE_TYPE_EXE_EXTRA_SECURITY_BITS
         image_type->flags |= PICOBIN_IMAGE_TYPE_EXE_EXTRA_SECURITY_BITS;
         std::shared_ptr<entry_point_item> entry_point = new_block.get_item<entry_point_item>();
@@ -5632,23 +7175,345 @@ vector<uint8_t> sign_guts_bin(iostream_memory_access in, private_t private_key,
             entry_point = std::make_shared<entry_point_item>(ep, sp);
             new_block.items.push_back(entry_point);
         }
-    }
+    }
+
+    auto sig_data = hash_andor_sign(
+        std::move(bin), bin_start, bin_start,
+        &new_block, public_key, private_key,
+        in.get_model(),
+        seal.hash, seal.sign,
+        seal.clear_sram, seal.pin_xip_sram
+    );
+    if (result) *result = seal_result(new_block);
+
+    return sig_data;
+}
+
+// An image for seal or encrypt: the <infile> and <outfile>, or one entry of a --batch manifest
+struct seal_image {
+    string input;
+    string output;
+    filetype type = filetype::bin;
+    model_t model;
+    uint32_t family_id = 0;
+    std::shared_ptr<std::fstream> in;
+    std::shared_ptr<iostream_memory_access> access; // BIN and UF2 only
+    seal_result result;
+};
+
+// seal/encrypt --batch processes images on up to this many threads
+#define SEAL_BATCH_MAX_THREADS 8u
+
+// Held while using the global settings (or anything else that isn't thread safe) when processing a seal_image
+static std::mutex seal_batch_mutex;
+
+// Open settings.filenames[0] as an image to be written to settings.filenames[1]. Everything which uses the global
+// settings is done here, so the image can then be processed on any thread
+static seal_image open_seal_image() {
+    seal_image image;
+    image.input = settings.filenames[0];
+    image.output = settings.filenames[1];
+    image.type = get_file_type();
+    if (get_file_type_idx(1) != image.type) {
+        fail(ERROR_ARGS, "Can only sign to same file type");
+    }
+    image.model = get_model(0);
+    image.family_id = get_family_id(0);
+    image.in = get_file(ios::in|ios::binary);
+    if (image.type != filetype::elf) {
+        image.access = std::make_shared<iostream_memory_access>(get_iostream_memory_access<iostream_memory_access>(image.in, image.type, false, nullptr, image.input));
+    }
+    return image;
+}
+
+// The output is only opened once the image has been processed, so a failure leaves any existing file alone
+static std::shared_ptr<std::fstream> open_seal_output(const seal_image &image) {
+    std::lock_guard<std::mutex> lock(seal_batch_mutex);
+    return get_file_named(ios::out|ios::binary, image.output);
+}
+
+// Process each image in the JSON manifest settings.filenames[0] on a pool of threads, and write their hashes and
+// signatures to the JSON report settings.filenames[1]. The manifest is of the form
+// {"images": [{"input": "a.elf", "output": "a_signed.elf"}, ...]}
+// open is called with settings.filenames[0] and [1] set to each image in turn, holding seal_batch_mutex
+static void seal_batch(const std::function<seal_image()> &open, const std::function<void(seal_image &)> &process) {
+    if (get_file_type() != filetype::json || get_file_type_idx(1) != filetype::json) {
+        fail(ERROR_ARGS, "--batch requires a JSON manifest and a JSON report file");
+    }
+    auto file = get_file(ios::in);
+    json manifest = json::parse(*file.get());
+    file->close();
+
+    struct batch_entry {
+        string input;
+        string output;
+        seal_result result;
+        string error;
+        int error_code = 0;
+    };
+    vector<batch_entry> entries;
+    if (!manifest.contains("images") || !manifest["images"].is_array()) {
+        fail(ERROR_FORMAT, "The batch manifest must contain an \"images\" array");
+    }
+    for (const auto &image : manifest["images"]) {
+        if (!image.contains("input") || !image["input"].is_string() || !image.contains("output") || !image["output"].is_string()) {
+            fail(ERROR_FORMAT, "Each image in the batch manifest must have an \"input\" and an \"output\" file name");
+        }
+        batch_entry entry;
+        entry.input = image["input"];
+        entry.output = image["output"];
+        entries.push_back(entry);
+    }
+
+    auto filenames = settings.filenames;
+    auto file_types = settings.file_types;
+    std::atomic<size_t> next_entry(0);
+    auto process_entries = [&] {
+        for (size_t i = next_entry++; i < entries.size(); i = next_entry++) {
+            auto &entry = entries[i];
+            try {
+                seal_image image;
+                {
+                    std::lock_guard<std::mutex> lock(seal_batch_mutex);
+                    settings.filenames[0] = entry.input;
+                    settings.filenames[1] = entry.output;
+                    settings.file_types[0].clear();
+                    settings.file_types[1].clear();
+                    image = open();
+                }
+                process(image);
+                entry.result = image.result;
+            } catch (failure_error &e) {
+                entry.error = e.what();
+                entry.error_code = e.code();
+            } catch (std::exception &e) {
+                entry.error = e.what();
+                entry.error_code = ERROR_UNKNOWN;
+            }
+        }
+    };
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::min(num_threads, (size_t)SEAL_BATCH_MAX_THREADS);
+    num_threads = std::max((size_t)1, std::min(num_threads, entries.size()));
+    vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; t++) {
+        threads.emplace_back(process_entries);
+    }
+    process_entries();
+    for (auto &t : threads) {
+        t.join();
+    }
+    settings.filenames = filenames;
+    settings.file_types = file_types;
+
+    auto to_hex = [](const vector<uint8_t> &bytes) {
+        string s;
+        for (auto b : bytes) s += hex_string(b, 2, false);
+        return s;
+    };
+    json report;
+    report["images"] = json::array();
+    int failures = 0;
+    int error_code = 0;
+    for (const auto &entry : entries) {
+        json image;
+        image["input"] = entry.input;
+        image["output"] = entry.output;
+        if (entry.error.empty()) {
+            if (!entry.result.hash_bytes.empty()) image["hash"] = to_hex(entry.result.hash_bytes);
+            if (!entry.result.signature_bytes.empty()) image["signature"] = to_hex(entry.result.signature_bytes);
+        } else {
+            image["error"] = entry.error;
+            if (!failures++) error_code = entry.error_code;
+        }
+        report["images"].push_back(image);
+        if (!settings.quiet) {
+            fos << entry.input << " -> " << entry.output << ": " << (entry.error.empty() ? "OK" : "FAILED: " + entry.error) << "\n";
+        }
+    }
+    auto report_file = get_file_idx(ios::out, 1);
+    *report_file << std::setw(4) << report << std::endl;
+    report_file->close();
+    if (failures) {
+        fail(error_code, "Failed to process %d of %d images", failures, (int)entries.size());
+    }
+}
+
+// Encrypt one image (see open_seal_image) with the AES key and IV salt, and sign and/or hash it
+static void encrypt_file_guts(seal_image &image, const aes_key_t &aes_key, const std::vector<uint8_t> &iv_salt, private_t private_key, public_t public_key, _settings::seal_settings seal) {
+    model_t model = image.model;
+
+    if (image.type == filetype::elf) {
+        elf_file source_file(settings.verbose);
+        elf_file *elf = &source_file;
+        elf->read_file(image.in);
+        // Remove any holes in the ELF file, as these cause issues when encrypting
+        elf->remove_ph_holes();
+        elf->remove_sh_holes();
+
+        std::unique_ptr<block> first_block = find_first_block(elf);
+        if (!first_block) {
+            fail(ERROR_FORMAT, "No first block found");
+        }
+        elf->editable = false;
+        block new_block = place_new_block(elf, first_block, model);
+        elf->editable = true;
+
+        // Delete any non-generic load_map entries, as they will be invalid after encryption
+        remove_non_generic_load_map_entries(&new_block, model);
+
+        if (settings.encrypt.embed) {
+            // Detect generic load maps from the encrypted binary, and populate options to propogate them
+            std::shared_ptr<load_map_item> load_map = new_block.get_item<load_map_item>();
+            if (load_map != nullptr) {
+                detect_generic_load_map(load_map, model, seal.pin_xip_sram);
+            }
+
+            std::vector<uint8_t> iv_data;
+            std::vector<uint8_t> enc_data;
+            uint32_t data_start_address = SRAM_START;
+            encrypt_guts(elf, &new_block, aes_key, model, iv_data, enc_data);
+
+            // Salt IV
+            assert(iv_data.size() == iv_salt.size());
+            for (int i=0; i < iv_data.size(); i++) {
+                iv_data[i] ^= iv_salt[i];
+            }
+            auto tmp = std::make_shared<std::stringstream>();
+            {
+                // config_guts works on the global settings
+                std::lock_guard<std::mutex> lock(seal_batch_mutex);
+                auto file = get_enc_bootloader(settings.encrypt.use_mbedtls);
+                *tmp << file->rdbuf();
+
+                auto program = get_iostream_memory_access<iostream_memory_access>(tmp, filetype::elf, true);
+                // todo should be determined from image_def
+                program.set_model(model);
+
+                // data_start_addr
+                settings.config.key = "data_start_addr";
+                settings.config.value = hex_string(data_start_address);
+                config_guts(program);
+                // data_size
+                settings.config.key = "data_size";
+                settings.config.value = hex_string(enc_data.size());
+                config_guts(program);
+                // iv
+                {
+                    string s((char*)iv_data.data(), iv_data.size());
+                    settings.config.key = "iv";
+                    settings.config.value = s;
+                    config_guts(program);
+                }
+                // otp_key_page
+                if (settings.encrypt.otp_key_page_set) {
+                    settings.config.key = "otp_key_page";
+                    settings.config.value = hex_string(settings.encrypt.otp_key_page);
+                    config_guts(program);
+                }
+
+                // fast rosc
+                if (settings.encrypt.fast_rosc) {
+                    settings.config.key = "rosc_div";
+                    settings.config.value = "0x1";
+                    config_guts(program);
+                    settings.config.key = "rosc_drive";
+                    settings.config.value = "0x0000";
+                    config_guts(program);
+                }
+            }
+
+            elf_file source_file(settings.verbose);
+            elf_file *enc_elf = &source_file;
+            enc_elf->read_file(tmp);
+
+            // Bootloader size
+            auto bootloader_symbols = enc_elf->get_symbols({"__enc_bootloader_start", "__enc_bootloader_end"});
+            auto bootloader_start = bootloader_symbols[0];
+            auto bootloader_end = bootloader_symbols[1];
+            uint32_t bootloader_size = bootloader_end - bootloader_start;
+
+            // Move bootloader down in physical space to start of SRAM (which will be start of flash once packaged)
+            enc_elf->move_all(data_start_address - bootloader_start);
+
+            // Add encrypted blob
+            enc_elf->append_segment(data_start_address, data_start_address + bootloader_size, enc_data.size(), ".enc_data");
+            auto data_section = enc_elf->get_section(".enc_data");
+            assert(data_section);
+            assert(data_section->virtual_address() == data_start_address);
+
+            if (data_section->size < enc_data.size()) {
+                fail(ERROR_UNKNOWN, "Block is too big for elf section\n");
+            }
+
+            DEBUG_LOG("Adding enc_data len %d\n", (int)enc_data.size());
+            for (auto x : enc_data) DEBUG_LOG("%02x", x);
+            DEBUG_LOG("\n");
+
+            enc_elf->content(*data_section, enc_data);
+
+            // Get the version from the encrypted binary
+            std::shared_ptr<version_item> version = new_block.get_item<version_item>();
+            if (version != nullptr) {
+                seal.major_version = version->major;
+                seal.minor_version = version->minor;
+                seal.rollback_version = version->rollback;
+                for (auto row : version->otp_rows) {
+                    seal.rollback_rows.push_back(row);
+                }
+            }
+
+            // Get the TBYB from the encrypted binary
+            std::shared_ptr<image_type_item> image_type = new_block.get_item<image_type_item>();
+            if (image_type->tbyb()) {
+                seal.set_tbyb = true;
+            }
+
+            // Sign the final thing
+            sign_guts_elf(enc_elf, private_key, public_key, model, image.family_id, seal, &image.result);
+
+            auto out = open_seal_output(image);
+            enc_elf->write(out);
+            out->close();
+        } else {
+            encrypt(elf, &new_block, aes_key, public_key, private_key, model, iv_salt, seal.hash, seal.sign);
+            image.result = seal_result(new_block);
+            auto out = open_seal_output(image);
+            elf->write(out);
+            out->close();
+        }
+    } else if (image.type == filetype::bin) {
+        auto &binfile = *image.access;
+        auto rmap = binfile.get_rmap();
+        auto ranges = rmap.ranges();
+        assert(ranges.size() == 1);
+        auto bin_start = ranges[0].from;
+        auto bin_size = ranges[0].len();
 
-    auto sig_data = hash_andor_sign(
-        bin, bin_start, bin_start,
-        &new_block, public_key, private_key,
-        in.get_model(),
-        settings.seal.hash, settings.seal.sign,
-        settings.seal.clear_sram, settings.seal.pin_xip_sram
-    );
+        vector<uint8_t> bin = binfile.read_vector<uint8_t>(bin_start, bin_size, false);
 
-    return sig_data;
+        std::unique_ptr<block> first_block = find_first_block(bin, bin_start);
+        if (!first_block) {
+            fail(ERROR_FORMAT, "No first block found");
+        }
+        auto bin_cp = bin;
+        block new_block = place_new_block(bin_cp, bin_start, first_block, model);
+
+        // Delete any non-generic load_map entries, as they will be invalid after encryption
+        remove_non_generic_load_map_entries(&new_block, model);
+
+        auto enc_data = encrypt(bin, bin_start, bin_start, &new_block, aes_key, public_key, private_key, binfile.get_model(), iv_salt, seal.hash, seal.sign);
+        image.result = seal_result(new_block);
+
+        auto out = open_seal_output(image);
+        out->write((const char *)enc_data.data(), enc_data.size());
+        out->close();
+    } else {
+        fail(ERROR_ARGS, "Must be ELF or BIN");
+    }
 }
 
 bool encrypt_command::execute(device_map &devices) {
-    bool isElf = false;
-    bool isBin = false;
-
     bool keyFromFile = true;
     bool keyIsShare = false;
     bool ivFromFile = true;
@@ -5661,21 +7526,6 @@ bool encrypt_command::execute(device_map &devices) {
     std::vector<uint8_t> iv_salt;
     iv_salt.resize(16);
 
-    if (get_file_type() == filetype::elf) {
-        isElf = true;
-    } else if (get_file_type() == filetype::bin) {
-        if (settings.encrypt.embed) {
-            fail(ERROR_ARGS, "Can only embed decrypting bootloader into ELFs");
-        }
-        isBin = true;
-    } else {
-        fail(ERROR_ARGS, "Can only sign ELFs or BINs");
-    }
-
-    if (get_file_type_idx(1) != get_file_type()) {
-        fail(ERROR_ARGS, "Can only sign to same file type");
-    }
-
     if (string_to_hex_array(settings.filenames[2], aes_key.bytes, sizeof(aes_key.bytes), "AES key")) {
         keyFromFile = false;
     } else if (get_file_type_idx(2) != filetype::bin) {
@@ -5818,168 +7668,23 @@ bool encrypt_command::execute(device_map &devices) {
         iv_salt_file->read((char*)iv_salt.data(), iv_salt.size());
     }
 
-    model_t model = get_model(0);
-
-    if (isElf) {
-        elf_file source_file(settings.verbose);
-        elf_file *elf = &source_file;
-        elf->read_file(get_file(ios::in|ios::binary));
-        // Remove any holes in the ELF file, as these cause issues when encrypting
-        elf->remove_ph_holes();
-        elf->remove_sh_holes();
-
-        std::unique_ptr<block> first_block = find_first_block(elf);
-        if (!first_block) {
-            fail(ERROR_FORMAT, "No first block found");
-        }
-        elf->editable = false;
-        block new_block = place_new_block(elf, first_block, model);
-        elf->editable = true;
-
-        // Delete any non-generic load_map entries, as they will be invalid after encryption
-        remove_non_generic_load_map_entries(&new_block, model);
-
-        if (settings.encrypt.embed) {
-            // Detect generic load maps from the encrypted binary, and populate options to propogate them
-            std::shared_ptr<load_map_item> load_map = new_block.get_item<load_map_item>();
-            if (load_map != nullptr) {
-                detect_generic_load_map(load_map, model, settings.seal.pin_xip_sram);
-            }
-
-            std::vector<uint8_t> iv_data;
-            std::vector<uint8_t> enc_data;
-            uint32_t data_start_address = SRAM_START;
-            encrypt_guts(elf, &new_block, aes_key, model, iv_data, enc_data);
-
-            // Salt IV
-            assert(iv_data.size() == iv_salt.size());
-            for (int i=0; i < iv_data.size(); i++) {
-                iv_data[i] ^= iv_salt[i];
-            }
-            auto tmp = std::make_shared<std::stringstream>();
-            auto file = get_enc_bootloader(settings.encrypt.use_mbedtls);
-            *tmp << file->rdbuf();
-
-            auto program = get_iostream_memory_access<iostream_memory_access>(tmp, filetype::elf, true);
-            // todo should be determined from image_def
-            program.set_model(model);
-
-            // data_start_addr
-            settings.config.key = "data_start_addr";
-            settings.config.value = hex_string(data_start_address);
-            config_guts(program);
-            // data_size
-            settings.config.key = "data_size";
-            settings.config.value = hex_string(enc_data.size());
-            config_guts(program);
-            // iv
-            {
-                string s((char*)iv_data.data(), iv_data.size());
-                settings.config.key = "iv";
-                settings.config.value = s;
-                config_guts(program);
-            }
-            // otp_key_page
-            if (settings.encrypt.otp_key_page_set) {
-                settings.config.key = "otp_key_page";
-                settings.config.value = hex_string(settings.encrypt.otp_key_page);
-                config_guts(program);
-            }
-
-            // fast rosc
-            if (settings.encrypt.fast_rosc) {
-                settings.config.key = "rosc_div";
-                settings.config.value = "0x1";
-                config_guts(program);
-                settings.config.key = "rosc_drive";
-                settings.config.value = "0x0000";
-                config_guts(program);
-            }
-
-            elf_file source_file(settings.verbose);
-            elf_file *enc_elf = &source_file;
-            enc_elf->read_file(tmp);
-
-            // Bootloader size
-            auto bootloader_start = enc_elf->get_symbol("__enc_bootloader_start");
-            auto bootloader_end = enc_elf->get_symbol("__enc_bootloader_end");
-            uint32_t bootloader_size = bootloader_end - bootloader_start;
-
-            // Move bootloader down in physical space to start of SRAM (which will be start of flash once packaged)
-            enc_elf->move_all(data_start_address - bootloader_start);
-
-            // Add encrypted blob
-            enc_elf->append_segment(data_start_address, data_start_address + bootloader_size, enc_data.size(), ".enc_data");
-            auto data_section = enc_elf->get_section(".enc_data");
-            assert(data_section);
-            assert(data_section->virtual_address() == data_start_address);
-
-            if (data_section->size < enc_data.size()) {
-                fail(ERROR_UNKNOWN, "Block is too big for elf section\n");
-            }
-
-            DEBUG_LOG("Adding enc_data len %d\n", (int)enc_data.size());
-            for (auto x : enc_data) DEBUG_LOG("%02x", x);
-            DEBUG_LOG("\n");
-
-            enc_elf->content(*data_section, enc_data);
-
-            // Get the version from the encrypted binary
-            std::shared_ptr<version_item> version = new_block.get_item<version_item>();
-            if (version != nullptr) {
-                settings.seal.major_version = version->major;
-                settings.seal.minor_version = version->minor;
-                settings.seal.rollback_version = version->rollback;
-                for (auto row : version->otp_rows) {
-                    settings.seal.rollback_rows.push_back(row);
-                }
-            }
-
-            // Get the TBYB from the encrypted binary
-            std::shared_ptr<image_type_item> image_type = new_block.get_item<image_type_item>();
-            if (image_type->tbyb()) {
-                settings.seal.set_tbyb = true;
-            }
-
-            // Sign the final thing
-            sign_guts_elf(enc_elf, private_key, public_key, model);
-
-            auto out = get_file_idx(ios::out|ios::binary, 1);
-            enc_elf->write(out);
-            out->close();
-        } else {
-            encrypt(elf, &new_block, aes_key, public_key, private_key, model, iv_salt, settings.seal.hash, settings.seal.sign);
-            auto out = get_file_idx(ios::out|ios::binary, 1);
-            elf->write(out);
-            out->close();
-        }
-    } else if (isBin) {
-        auto binfile = get_file_memory_access(0);
-        auto rmap = binfile.get_rmap();
-        auto ranges = rmap.ranges();
-        assert(ranges.size() == 1);
-        auto bin_start = ranges[0].from;
-        auto bin_size = ranges[0].len();
-
-        vector<uint8_t> bin = binfile.read_vector<uint8_t>(bin_start, bin_size, false);
-
-        std::unique_ptr<block> first_block = find_first_block(bin, bin_start);
-        if (!first_block) {
-            fail(ERROR_FORMAT, "No first block found");
+    auto open = [] {
+        if (get_file_type() == filetype::bin && settings.encrypt.embed) {
+            fail(ERROR_ARGS, "Can only embed decrypting bootloader into ELFs");
+        } else if (get_file_type() != filetype::elf && get_file_type() != filetype::bin) {
+            fail(ERROR_ARGS, "Can only sign ELFs or BINs");
         }
-        auto bin_cp = bin;
-        block new_block = place_new_block(bin_cp, bin_start, first_block, model);
-
-        // Delete any non-generic load_map entries, as they will be invalid after encryption
-        remove_non_generic_load_map_entries(&new_block, model);
-
-        auto enc_data = encrypt(bin, bin_start, bin_start, &new_block, aes_key, public_key, private_key, binfile.get_model(), iv_salt, settings.seal.hash, settings.seal.sign);
-
-        auto out = get_file_idx(ios::out|ios::binary, 1);
-        out->write((const char *)enc_data.data(), enc_data.size());
-        out->close();
+        return open_seal_image();
+    };
+    const auto seal = settings.seal;
+    auto process = [&](seal_image &image) {
+        encrypt_file_guts(image, aes_key, iv_salt, private_key, public_key, seal);
+    };
+    if (settings.seal.batch) {
+        seal_batch(open, process);
     } else {
-        fail(ERROR_ARGS, "Must be ELF or BIN");
+        auto image = open();
+        process(image);
     }
 
     if (!settings.filenames[5].empty()) {
@@ -6113,24 +7818,60 @@ bool encrypt_command::execute(device_map &devices) {
     return false;
 }
 
-bool seal_command::execute(device_map &devices) {
-    bool isElf = false;
-    bool isBin = false;
-    bool isUf2 = false;
-    if (get_file_type() == filetype::elf) {
-        isElf = true;
-    } else if (get_file_type() == filetype::bin) {
-        isBin = true;
-    } else if (get_file_type() == filetype::uf2) {
-        isUf2 = true;
-    } else {
-        fail(ERROR_ARGS, "Can only sign ELFs, BINs or UF2s");
-    }
+// Seal one image (see open_seal_image), optionally including a hash and/or signature
+static void seal_file_guts(seal_image &image, private_t private_key, public_t public_key, const _settings::seal_settings &seal) {
+    model_t model = image.model;
 
-    if (get_file_type_idx(1) != get_file_type()) {
-        fail(ERROR_ARGS, "Can only sign to same file type");
+    if (image.type == filetype::elf) {
+        elf_file source_file(settings.verbose);
+        elf_file *elf = &source_file;
+        elf->read_file(image.in);
+        if (!seal.no_squash) {
+            // Squash the segments together
+            elf->store_squashed(model);
+        }
+        // Remove any holes in the ELF file, as these cause issues when signing/hashing
+        elf->remove_sh_holes();
+        sign_guts_elf(elf, private_key, public_key, model, image.family_id, seal, &image.result);
+
+        auto out = open_seal_output(image);
+        elf->write(out);
+        out->close();
+    } else if (image.type == filetype::bin) {
+        auto &access = *image.access;
+        auto rmap = access.get_rmap();
+        auto ranges = rmap.ranges();
+        assert(ranges.size() == 1);
+        auto bin_start = ranges[0].from;
+        auto bin_size = ranges[0].len();
+
+        auto sig_data = sign_guts_bin(access, private_key, public_key, bin_start, bin_size, model, image.family_id, seal, &image.result);
+        auto out = open_seal_output(image);
+        out->write((const char *)sig_data.data(), sig_data.size());
+        out->close();
+    } else if (image.type == filetype::uf2) {
+        auto &access = *image.access;
+        auto rmap = access.get_rmap();
+        auto ranges = rmap.ranges();
+        auto bin_start = ranges.front().from;
+        auto bin_size = ranges.back().to - bin_start;
+
+        auto sig_data = sign_guts_bin(access, private_key, public_key, bin_start, bin_size, model, image.family_id, seal, &image.result);
+        auto tmp = std::make_shared<std::stringstream>();
+        tmp->write(reinterpret_cast<const char*>(sig_data.data()), sig_data.size());
+        auto out = open_seal_output(image);
+        {
+            // bin2uf2 uses global state
+            std::lock_guard<std::mutex> lock(seal_batch_mutex);
+            bin2uf2(tmp, out, bin_start, image.family_id, access.get_model(), settings.uf2.abs_block_loc);
+        }
+        out->close();
+    } else {
+        fail(ERROR_ARGS, "Must be ELF or BIN");
     }
+}
 
+bool seal_command::execute(device_map &devices) {
     if (settings.seal.sign && settings.filenames[2].empty()) {
         fail(ERROR_ARGS, "missing key file for signing");
     }
@@ -6171,51 +7912,21 @@ bool seal_command::execute(device_map &devices) {
 
     if (settings.seal.sign) read_keys(settings.filenames[2], &public_key, &private_key);
 
-    model_t model = get_model(0);
-
-    if (isElf) {
-        elf_file source_file(settings.verbose);
-        elf_file *elf = &source_file;
-        elf->read_file(get_file(ios::in|ios::binary));
-        if (!settings.seal.no_squash) {
-            // Squash the segments together
-            elf->store_squashed(model);
+    auto open = [] {
+        if (get_file_type() != filetype::elf && get_file_type() != filetype::bin && get_file_type() != filetype::uf2) {
+            fail(ERROR_ARGS, "Can only sign ELFs, BINs or UF2s");
         }
-        // Remove any holes in the ELF file, as these cause issues when signing/hashing
-        elf->remove_sh_holes();
-        sign_guts_elf(elf, private_key, public_key, model);
-
-        auto out = get_file_idx(ios::out|ios::binary, 1);
-        elf->write(out);
-        out->close();
-    } else if (isBin) {
-        auto access = get_file_memory_access(0);
-        auto rmap = access.get_rmap();
-        auto ranges = rmap.ranges();
-        assert(ranges.size() == 1);
-        auto bin_start = ranges[0].from;
-        auto bin_size = ranges[0].len();
-
-        auto sig_data = sign_guts_bin(access, private_key, public_key, bin_start, bin_size, model);
-        auto out = get_file_idx(ios::out|ios::binary, 1);
-        out->write((const char *)sig_data.data(), sig_data.size());
-        out->close();
-    } else if (isUf2) {
-        auto access = get_file_memory_access(0);
-        auto rmap = access.get_rmap();
-        auto ranges = rmap.ranges();
-        auto bin_start = ranges.front().from;
-        auto bin_size = ranges.back().to - bin_start;
-        auto family_id = get_family_id(0);
-
-        auto sig_data = sign_guts_bin(access, private_key, public_key, bin_start, bin_size, model);
-        auto tmp = std::make_shared<std::stringstream>();
-        tmp->write(reinterpret_cast<const char*>(sig_data.data()), sig_data.size());
-        auto out = get_file_idx(ios::out|ios::binary, 1);
-        bin2uf2(tmp, out, bin_start, family_id, access.get_model(), settings.uf2.abs_block_loc);
-        out->close();
+        return open_seal_image();
+    };
+    const auto seal = settings.seal;
+    auto process = [&](seal_image &image) {
+        seal_file_guts(image, private_key, public_key, seal);
+    };
+    if (settings.seal.batch) {
+        seal_batch(open, process);
     } else {
-        fail(ERROR_ARGS, "Must be ELF or BIN");
+        auto image = open();
+        process(image);
     }
 
     if (settings.seal.sign) {
@@ -6254,7 +7965,7 @@ bool seal_command::execute(device_map &devices) {
         }
     }
 
-    if (!settings.quiet) {
+    if (!settings.quiet && !settings.seal.batch) {
         auto access = get_file_memory_access(1);
         set_model_from_metadata(access);
         fos << "Output File " << settings.filenames[1] << ":\n\n";
@@ -6631,8 +8342,8 @@ DRESULT disk_ioctl (void *drv, BYTE cmd, void* buff) {
                     fail(ERROR_NOT_POSSIBLE, "Start or end is out of range");
                     return RES_PARERR;
                 }
-                for (uint32_t addr = start; addr < end; addr += FLASH_SECTOR_ERASE_SIZE) {
-                    bdevfs_setup.connection->flash_erase(addr, FLASH_SECTOR_ERASE_SIZE);
+                for (const auto &e : plan_flash_erase(range(start, end), bdevfs_setup.access->can_block_erase())) {
+                    bdevfs_setup.connection->flash_erase(e.from, e.len());
                 }
                 return RES_OK;
             } else {
@@ -7279,6 +8990,7 @@ bool verify_command::execute(device_map &devices) {
         }
     }
     ranges.erase(std::remove_if(ranges.begin(), ranges.end(), std::mem_fn(&range::empty)), ranges.end());
+    raw_access.enable_device_crcs = can_use_device_crcs(ranges, model);
     if (ranges.empty()) {
         std::cout << "No ranges to verify.\n";
     } else {
@@ -7293,7 +9005,6 @@ bool verify_command::execute(device_map &devices) {
                 {
                     progress_bar bar("Verifying " + memory_names[t1] + ": ");
                     vector<uint8_t> file_buf;
-                    vector<uint8_t> device_buf;
                     uint32_t batch_size = calculate_chunk_size(mem_range.len());
                     for(uint32_t base = mem_range.from; base < mem_range.to && ok; base += batch_size) {
                         uint32_t this_batch = std::min(mem_range.to - base, batch_size);
@@ -7301,18 +9012,8 @@ bool verify_command::execute(device_map &devices) {
                         // mean that the verification will fail if those holes are not filled with zeros
                         // on the device
                         file_access.read_into_vector(base, this_batch, file_buf, true);
-                        raw_access.read_into_vector(base, this_batch, device_buf);
-                        assert(file_buf.size() == device_buf.size());
-                        for(unsigned int i=0;i<this_batch;i++) {
-                            if (file_buf[i] != device_buf[i]) {
-                                pos = base + i;
-                                ok = false;
-                                break;
-                            }
-                        }
-                        if (ok) {
-                            pos = base + this_batch;
-                        }
+                        pos = find_device_mismatch(raw_access, base, file_buf);
+                        ok = pos == base + this_batch;
                         bar.progress(pos - mem_range.from, mem_range.to - mem_range.from);
                     }
                 }
@@ -8135,29 +9836,28 @@ bool uf2_combine_command::execute(device_map &devices) {
 
     out->seekp(0, ios::beg);
 
+    // every block from both files is written, so num_blocks is the total number of blocks in them
     unsigned int num_blocks = 0;
-    for (auto file : {file1, file2}) {
-        uf2_block block;
-        // Seek to 2nd block, in case 1st is abs_block
-        file->seekg(0, ios::beg);
-        file->read((char*)&block, sizeof(uf2_block));
-        if (file->fail()) {
-            fail(ERROR_READ_FAILED, "unexpected end of input file");
+    for (uint8_t idx : {1, 2}) {
+        auto index = get_uf2_index(idx == 1 ? file1 : file2, settings.filenames[idx]);
+        if (index->families.empty()) {
+            fail(ERROR_FORMAT, "'%s' does not contain any UF2 blocks", settings.filenames[idx].c_str());
         }
 
     #if SUPPORT_RP2350_A2
-        if (check_abs_block(block)) {
+        if (index->has_abs_block) {
             // save abs block address
             settings.uf2.abs_block = true;
-            settings.uf2.abs_block_loc = block.target_addr;
-            file->read((char*)&block, sizeof(uf2_block));
+            settings.uf2.abs_block_loc = index->abs_block_loc;
         }
     #endif
 
-        num_blocks += block.num_blocks;
+        for (const auto &f : index->families) {
+            num_blocks += f.block_count;
+        }
 
         if (!settings.family_id) {
-            settings.family_id = block.file_size;
+            settings.family_id = index->families.front().family_id;
         }
     }
 
@@ -8171,36 +9871,23 @@ bool uf2_combine_command::execute(device_map &devices) {
     unsigned int block_no = 0;
     unsigned int file_no = 0;
     for (auto file : {file1, file2}) {
-        file->seekg(0, ios::beg);
-        uf2_block block;
-        unsigned int pos = 0;
-        uint32_t next_family_id = 0;
-        do {
-            file->read((char*)&block, sizeof(uf2_block));
-            if (file->fail()) {
-                if (file->eof()) { file->clear(); break; }
-                fail(ERROR_READ_FAILED, "unexpected end of input file");
-            }
-            if (block.magic_start0 == UF2_MAGIC_START0 && block.magic_start1 == UF2_MAGIC_START1 &&
-                block.magic_end == UF2_MAGIC_END) {
-                if (block.flags & UF2_FLAG_FAMILY_ID_PRESENT &&
-                    !(block.flags & UF2_FLAG_NOT_MAIN_FLASH) && block.payload_size == PAGE_SIZE) {
-                    // ignore the absolute block
-                    if (check_abs_block(block)) {
-                        DEBUG_LOG("Ignoring RP2350-E10 absolute block\n");
-                    } else {
-                        block.block_no = block_no; block_no++;
-                        block.num_blocks = num_blocks;
-                        block.file_size = settings.family_id;
-                        if (settings.uf2.offset_set && file_no == 1) {
-                            block.target_addr += settings.uf2.offset;
-                        }
-                        out->write((char*)&block, sizeof(uf2_block));
+        for_each_uf2_block(file, [&](uf2_block block, size_t pos) {
+            if (block.flags & UF2_FLAG_FAMILY_ID_PRESENT &&
+                !(block.flags & UF2_FLAG_NOT_MAIN_FLASH) && block.payload_size == PAGE_SIZE) {
+                // ignore the absolute block
+                if (is_abs_block(block)) {
+                    DEBUG_LOG("Ignoring RP2350-E10 absolute block\n");
+                } else {
+                    block.block_no = block_no; block_no++;
+                    block.num_blocks = num_blocks;
+                    block.file_size = settings.family_id;
+                    if (settings.uf2.offset_set && file_no == 1) {
+                        block.target_addr += settings.uf2.offset;
                     }
+                    out->write((char*)&block, sizeof(uf2_block));
                 }
             }
-            pos += sizeof(uf2_block);
-        } while (true);
+        });
         file_no++;
     }
 
@@ -9794,7 +11481,8 @@ bool otp_permissions_command::execute(device_map &devices) {
     elf_file source_file(settings.verbose);
     elf_file *elf = &source_file;
     elf->read_file(tmp);
-    sign_guts_elf(elf, private_key, public_key, program.get_model());
+    // the xip_ram_perms program is an RP2350 Arm secure binary
+    sign_guts_elf(elf, private_key, public_key, program.get_model(), RP2350_ARM_S_FAMILY_ID, settings.seal);
     auto out = std::make_shared<std::stringstream>();
     elf->write(out);
 
@@ -10140,6 +11828,35 @@ static void sleep_ms(int ms) {
 #endif
 }
 
+#if HAS_LIBUSB
+static int LIBUSB_CALL count_device_arrival(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data) {
+    (*(int *)user_data)++;
+    return 0; // stay registered
+}
+
+// Wait for up to timeout_ms, returning early if a device arrives (counted in arrivals by count_device_arrival);
+// without hotplug support this just sleeps
+static void wait_for_device_arrival(libusb_context *ctx, bool hotplug, const int &arrivals, int timeout_ms) {
+    if (!hotplug) {
+        sleep_ms(timeout_ms);
+        return;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    int seen = arrivals;
+    while (arrivals == seen) {
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) break;
+        struct timeval tv;
+        tv.tv_sec = (long)(remaining / 1000000);
+        tv.tv_usec = (long)(remaining % 1000000);
+        if (libusb_handle_events_timeout_completed(ctx, &tv, nullptr)) {
+            sleep_ms((int)(remaining / 1000));
+            break;
+        }
+    }
+}
+#endif
+
 void get_terminal_size(int& width, int& height) {
 #if defined(DOCS_WIDTH)
     width = DOCS_WIDTH;
@@ -10193,6 +11910,9 @@ int main(int argc, char **argv) {
     struct libusb_device **devs = nullptr;
     device_map devices;
     vector<libusb_device_handle *> to_close;
+    bool hotplug = false;
+    libusb_hotplug_callback_handle hotplug_handle = 0;
+    int arrivals = 0;
 
     try {
         signal(SIGINT, cancelled);
@@ -10206,10 +11926,15 @@ int main(int argc, char **argv) {
             if (libusb_init(&ctx)) {
                 fail(ERROR_USB, "Failed to initialise libUSB\n");
             }
+            picoboot_async_init(ctx, PICOBOOT_DEFAULT_QUEUE_DEPTH);
         }
 
         // we only loop a second time if we want to reboot some devices (which may cause device
-        for (int tries = 0; !rc && tries <= MAX_REBOOT_TRIES; tries++) {
+        std::chrono::steady_clock::time_point reboot_deadline, last_progress;
+        int reboot_poll_ms = REBOOT_POLL_MIN_MS;
+        for (int tries = 0; !rc; tries++) {
+            // when waiting for a rebooted device, this is the last look for it
+            bool last_try = tries && std::chrono::steady_clock::now() >= reboot_deadline;
             if (ctx) {
                 if (libusb_get_device_list(ctx, &devs) < 0) {
                     fail(ERROR_USB, "Failed to enumerate USB devices\n");
@@ -10242,9 +11967,10 @@ int main(int argc, char **argv) {
                     if (!settings.filenames[0].empty()) break;
                     // fall thru
                 case cmd::device_support::one:
+                case cmd::device_support::one_or_more:
                     if (devices[dr_vidpid_bootrom_ok].empty() &&
                         (!settings.force || devices[dr_vidpid_stdio_usb].empty())) {
-                        if (tries == 0 || tries == MAX_REBOOT_TRIES) {
+                        if (tries == 0 || last_try) {
                             if (tries) {
                                 fos << "\n\n";
                             }
@@ -10307,8 +12033,10 @@ int main(int argc, char **argv) {
                         if (!devices[dr_vidpid_bootrom_ok].empty()) {
                             settings.force = false; // we have a device, so we're not forcing
                         }
-                    } else if (supported == cmd::device_support::zero_or_more && settings.force && !devices[dr_vidpid_bootrom_ok].empty()) {
-                        // we have usable devices, so lets use them without force
+                    } else if ((supported == cmd::device_support::zero_or_more || settings.load.all_devices) &&
+                               settings.force && !devices[dr_vidpid_bootrom_ok].empty()) {
+                        // we have usable devices, so lets use them without force (for load --all-devices, the
+                        // devices already in BOOTSEL mode are loaded, rather than forcing the others to reboot)
                         settings.force = false;
                     }
                     fos.first_column(0);
@@ -10354,22 +12082,34 @@ int main(int argc, char **argv) {
                                 }
                             }
 
+                            // listen for devices arriving before the reboot, so we can't miss it coming back
+                            hotplug = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) &&
+                                libusb_hotplug_register_callback(ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, (libusb_hotplug_flag)0,
+                                    LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                                    count_device_arrival, &arrivals, &hotplug_handle) == LIBUSB_SUCCESS;
                             reboot_device(to_reboot, to_reboot_handle, true, disable_mask);
                             fos << "The device was asked to reboot into BOOTSEL mode so the command can be executed.";
+                            reboot_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(REBOOT_TIMEOUT_MS);
+                        } else if (last_try) {
+                            break;
                         } else if (tries == 1) {
                             fos << "\nWaiting for device to reboot";
-                        } else {
+                            last_progress = std::chrono::steady_clock::now();
+                        } else if (std::chrono::steady_clock::now() - last_progress >= std::chrono::seconds(1)) {
                             fos << "...";
+                            last_progress = std::chrono::steady_clock::now();
                         }
                         fos.flush();
                         for (const auto &handle : to_close) {
-                            libusb_close(handle);
+                            close_device(handle);
                         }
                         libusb_free_device_list(devs, 1);
                         devs = nullptr;
                         to_close.clear();
                         devices.clear();
-                        sleep_ms(1200);
+                        long long remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(reboot_deadline - std::chrono::steady_clock::now()).count();
+                        wait_for_device_arrival(ctx, hotplug, arrivals, (int)std::max(0LL, std::min((long long)reboot_poll_ms, remaining_ms)));
+                        reboot_poll_ms = std::min(reboot_poll_ms * 2, REBOOT_POLL_MAX_MS);
 
                         // we now clear bus/address filters, because the device may have moved, so the only way we can find it
                         // again is to assume it has the same serial number.
@@ -10425,9 +12165,10 @@ int main(int argc, char **argv) {
     }
 
     for(const auto &handle : to_close) {
-        libusb_close(handle);
+        close_device(handle);
     }
     if (devs) libusb_free_device_list(devs, 1);
+    if (hotplug) libusb_hotplug_deregister_callback(ctx, hotplug_handle);
     if (ctx) libusb_exit(ctx);
 
 #else
@@ -11,6 +11,8 @@
 // todo amy based on what sort of elf
 #define XIP_SRAM_START_RP2040   0x15000000 // same as XIP_SRAM_BASE in addressmap.h
 #define XIP_SRAM_END_RP2040     0x15004000 // same as XIP_SRAM_END in addressmap.h
+#define XIP_NOCACHE_NOALLOC_BASE_RP2040 0x13000000 // same as XIP_NOCACHE_NOALLOC_BASE in addressmap.h
+#define XIP_SSI_BASE_RP2040     0x18000000 // same as XIP_SSI_BASE in addressmap.h
 #define XIP_SRAM_START_RP2350   0x13ffc000 // same as XIP_SRAM_BASE in addressmap.h
 #define XIP_SRAM_END_RP2350     0x14000000 // same as XIP_SRAM_END in addressmap.h
 
@@ -19,6 +21,7 @@
 #define SRAM_END_RP2040         0x20042000 // same as SRAM_END in addressmap.h
 #define SRAM_STRIPED_END_RP2350 0x20080000 // same as SRAM_STRIPED_END in addressmap.h
 #define SRAM_END_RP2350         0x20082000 // same as SRAM_END in addressmap.h
+#define IO_QSPI_BASE_RP2040     0x40018000 // same as IO_QSPI_BASE in addressmap.h
 // todo amy no more banked alias
 #define MAIN_RAM_BANKED_START   0x21000000
 #define MAIN_RAM_BANKED_END     0x21040000
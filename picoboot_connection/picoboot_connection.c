@@ -21,49 +21,265 @@
 #endif
 
 static bool verbose;
-static bool definitely_exclusive;
-static enum {
+
+enum xip_state {
     XIP_UNKOWN,
     XIP_ACTIVE,
     XIP_INACTIVE,
-} xip_state;
+};
 
 // todo test sparse binary (well actually two range is this)
 
-uint32_t crc32_for_byte(uint32_t remainder) {
-    const uint32_t POLYNOMIAL = 0x4C11DB7;
-    remainder <<= 24u;
-    for (unsigned int bit = 8; bit > 0; bit--) {
-        if (remainder & 0x80000000)
-            remainder = (remainder << 1) ^ POLYNOMIAL;
-        else
-            remainder = (remainder << 1);
+// Pipelined transport
+//
+// Each PICOBOOT command is three bulk transfers (command, data, ack), and the device NAKs the next command until it
+// has finished the current one, so the transfers for several commands can be queued up front. This removes the host
+// round trip between consecutive commands; the device processes them back to back.
+//
+// Transfers on the same endpoint complete in submission order, so the ring below is always retired oldest first.
+struct async_cmd {
+    struct picoboot_cmd cmd;
+    uint8_t spoon[64];
+    struct libusb_transfer *transfers[3];
+    // num_transfers is set before anything is submitted, as with several devices in use another thread's event loop
+    // may run the callbacks for this command while the rest of its transfers are still being submitted
+    int num_transfers;
+    int num_submitted;
+    int num_completed;
+    int done;
+    int ret;
+};
+
+static libusb_context *async_ctx;
+static unsigned int async_queue_depth = PICOBOOT_DEFAULT_QUEUE_DEPTH;
+
+// Per-connection state, so that several devices can be driven at once, each from its own thread. Devices must be
+// opened and closed from one thread, but commands to different devices may then be issued concurrently.
+struct picoboot_device_state {
+    libusb_device_handle *usb_device;
+    struct picoboot_device_state *next;
+    unsigned int interface;
+    unsigned int out_ep;
+    unsigned int in_ep;
+    enum xip_state xip_state;
+    bool definitely_exclusive;
+    int token;
+    int one_time_bulk_timeout;
+    struct async_cmd async_cmds[PICOBOOT_MAX_QUEUE_DEPTH];
+    unsigned int async_head;
+    unsigned int async_count;
+};
+
+static struct picoboot_device_state *device_states;
+// used for handles which weren't opened by picoboot_open_device
+static struct picoboot_device_state unknown_device_state = { .token = 1 };
+
+static struct picoboot_device_state *get_device_state(libusb_device_handle *usb_device) {
+    for (struct picoboot_device_state *s = device_states; s; s = s->next) {
+        if (s->usb_device == usb_device) return s;
+    }
+    return &unknown_device_state;
+}
+
+static struct picoboot_device_state *add_device_state(libusb_device_handle *usb_device) {
+    struct picoboot_device_state *s = calloc(1, sizeof(struct picoboot_device_state));
+    if (!s) return &unknown_device_state;
+    s->usb_device = usb_device;
+    s->token = 1;
+    s->next = device_states;
+    device_states = s;
+    return s;
+}
+
+static void remove_device_state(libusb_device_handle *usb_device) {
+    for (struct picoboot_device_state **ps = &device_states; *ps; ps = &(*ps)->next) {
+        struct picoboot_device_state *s = *ps;
+        if (s->usb_device == usb_device) {
+            *ps = s->next;
+            for (unsigned int i = 0; i < PICOBOOT_MAX_QUEUE_DEPTH; i++) {
+                for (int t = 0; t < 3; t++) {
+                    if (s->async_cmds[i].transfers[t]) libusb_free_transfer(s->async_cmds[i].transfers[t]);
+                }
+            }
+            free(s);
+            return;
+        }
     }
-    return remainder;
 }
 
-uint32_t crc32_sw(const uint8_t *buf, unsigned int count, uint32_t crc) {
-    static uint32_t table[0x100];
-    if (!table[1]) {
-        for (unsigned int i = 0; i < count_of(table); i++) {
-            table[i] = crc32_for_byte(i);
+void picoboot_async_init(libusb_context *ctx, unsigned int queue_depth) {
+    async_ctx = ctx;
+    async_queue_depth = MIN(queue_depth, PICOBOOT_MAX_QUEUE_DEPTH);
+}
+
+unsigned int picoboot_async_queue_depth(void) {
+    return async_ctx ? async_queue_depth : 0;
+}
+
+static int transfer_status_to_error(enum libusb_transfer_status status) {
+    switch (status) {
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            return LIBUSB_ERROR_TIMEOUT;
+        case LIBUSB_TRANSFER_STALL:
+            return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            return LIBUSB_ERROR_NO_DEVICE;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            return LIBUSB_ERROR_OVERFLOW;
+        case LIBUSB_TRANSFER_CANCELLED:
+            return LIBUSB_ERROR_INTERRUPTED;
+        default:
+            return LIBUSB_ERROR_IO;
+    }
+}
+
+static void LIBUSB_CALL async_transfer_cb(struct libusb_transfer *transfer) {
+    struct async_cmd *ac = (struct async_cmd *) transfer->user_data;
+    if (!ac->ret) {
+        if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+            output("  ...async transfer failed %s\n", libusb_error_name(transfer_status_to_error(transfer->status)));
+            ac->ret = transfer_status_to_error(transfer->status);
+        } else if (transfer != ac->transfers[ac->num_transfers - 1] && transfer->actual_length != transfer->length) {
+            // the ack (always the last transfer) is zero length, so only the command and data lengths are checked
+            output("  ...async transfer short %d/%d\n", transfer->actual_length, transfer->length);
+            ac->ret = 1;
         }
     }
-    for (unsigned int i = 0; i < count; ++i) {
-        crc = (crc << 8u) ^ table[(uint8_t) ((crc >> 24u) ^ buf[i])];
+    if (++ac->num_completed == ac->num_transfers) {
+        ac->done = 1;
     }
-    return crc;
 }
 
-unsigned int interface;
-unsigned int out_ep;
-unsigned int in_ep;
+static int async_submit_transfer(libusb_device_handle *usb_device, struct async_cmd *ac, unsigned char ep,
+                                 uint8_t *buffer, int len, unsigned int timeout) {
+    int idx = ac->num_submitted;
+    if (!ac->transfers[idx]) {
+        ac->transfers[idx] = libusb_alloc_transfer(0);
+        if (!ac->transfers[idx]) return LIBUSB_ERROR_NO_MEM;
+    }
+    libusb_fill_bulk_transfer(ac->transfers[idx], usb_device, ep, buffer, len, async_transfer_cb, ac, timeout);
+    int ret = libusb_submit_transfer(ac->transfers[idx]);
+    if (!ret) ac->num_submitted++;
+    return ret;
+}
+
+// a submit failed part way through a command; count the transfers which will now never be submitted as completed.
+// this is done holding the event lock, as callbacks for the transfers which were submitted are run with it held
+static void async_abandon_unsubmitted(struct async_cmd *ac, int ret) {
+    libusb_lock_events(async_ctx);
+    if (!ac->ret) ac->ret = ret;
+    ac->num_completed += ac->num_transfers - ac->num_submitted;
+    if (ac->num_completed == ac->num_transfers) {
+        ac->done = 1;
+    }
+    libusb_unlock_events(async_ctx);
+}
+
+static void async_wait(struct async_cmd *ac) {
+    while (!ac->done) {
+        int ret = libusb_handle_events_completed(async_ctx, &ac->done);
+        if (ret && ret != LIBUSB_ERROR_INTERRUPTED && !ac->ret) {
+            ac->ret = ret;
+        }
+    }
+}
+
+// cancel everything in flight; used after a failure, as the device will have stalled the endpoints anyway
+static void async_cancel_all(struct picoboot_device_state *s) {
+    for (unsigned int i = 0; i < s->async_count; i++) {
+        struct async_cmd *ac = &s->async_cmds[(s->async_head + i) % PICOBOOT_MAX_QUEUE_DEPTH];
+        if (!ac->done) {
+            for (int t = 0; t < ac->num_submitted; t++) {
+                libusb_cancel_transfer(ac->transfers[t]);
+            }
+        }
+    }
+    for (unsigned int i = 0; i < s->async_count; i++) {
+        async_wait(&s->async_cmds[(s->async_head + i) % PICOBOOT_MAX_QUEUE_DEPTH]);
+    }
+    s->async_head = s->async_count = 0;
+    s->xip_state = XIP_UNKOWN;
+    s->definitely_exclusive = false;
+}
+
+static int async_retire_oldest(struct picoboot_device_state *s) {
+    struct async_cmd *ac = &s->async_cmds[s->async_head];
+    async_wait(ac);
+    s->async_head = (s->async_head + 1) % PICOBOOT_MAX_QUEUE_DEPTH;
+    s->async_count--;
+    if (ac->ret) {
+        if (verbose) output("  ...queued command %08x failed %d\n", ac->cmd.dToken, ac->ret);
+        async_cancel_all(s);
+    }
+    return ac->ret;
+}
+
+int picoboot_async_wait(libusb_device_handle *usb_device, unsigned int max_pending) {
+    struct picoboot_device_state *s = get_device_state(usb_device);
+    while (s->async_count > max_pending) {
+        int ret = async_retire_oldest(s);
+        if (ret) return ret;
+    }
+    return 0;
+}
+
+int picoboot_async_flush(libusb_device_handle *usb_device) {
+    return picoboot_async_wait(usb_device, 0);
+}
+
+// worst case time for the bootrom to erase len bytes, allowing 2s per 64K block erase and 400ms per 4K sector erase
+// (the maximums for typical QSPI flash)
+static unsigned int flash_erase_timeout(uint32_t len) {
+    return 10000 + (len / FLASH_BLOCK_ERASE_SIZE) * 2000 + ((len % FLASH_BLOCK_ERASE_SIZE) / FLASH_SECTOR_ERASE_SIZE) * 400;
+}
+
+static int picoboot_cmd_async(libusb_device_handle *usb_device, struct picoboot_cmd *cmd, uint8_t *buffer) {
+    struct picoboot_device_state *s = get_device_state(usb_device);
+    int ret;
+    if (s->async_count == async_queue_depth) {
+        ret = async_retire_oldest(s);
+        if (ret) return ret;
+    }
+    struct async_cmd *ac = &s->async_cmds[(s->async_head + s->async_count) % PICOBOOT_MAX_QUEUE_DEPTH];
+    s->async_count++;
+    ac->cmd = *cmd;
+    ac->cmd.dMagic = PICOBOOT_MAGIC;
+    ac->cmd.dToken = s->token++;
+    ac->num_submitted = ac->num_completed = ac->done = ac->ret = 0;
+    // command, optional data, then ack
+    ac->num_transfers = ac->cmd.dTransferLength != 0 ? 3 : 2;
+
+    // the timeouts start on submission, so allow for the commands queued ahead of this one
+    unsigned int scale = s->async_count;
+    bool in = ac->cmd.bCmdId & 0x80u;
+    ret = async_submit_transfer(usb_device, ac, s->out_ep, (uint8_t *) &ac->cmd, sizeof(struct picoboot_cmd), 3000 * scale);
+    if (!ret && ac->cmd.dTransferLength != 0) {
+        ret = async_submit_transfer(usb_device, ac, in ? s->in_ep : s->out_ep, buffer, (int) ac->cmd.dTransferLength, 10000 * scale);
+    }
+    if (!ret) {
+        // ack is in opposite direction
+        unsigned int ack_timeout = ac->cmd.dTransferLength != 0 ? 3000 :
+                                   ac->cmd.bCmdId == PC_FLASH_ERASE ? flash_erase_timeout(ac->cmd.range_cmd.dSize) : 10000;
+        ret = async_submit_transfer(usb_device, ac, in ? s->out_ep : s->in_ep, ac->spoon, 1, ack_timeout * scale);
+    }
+    if (ret) {
+        output("   ...failed to queue command %s\n", libusb_error_name(ret));
+        async_abandon_unsubmitted(ac, ret);
+        async_cancel_all(s);
+        return ret;
+    }
+    // flash erase, like read and write, leaves the flash out of XIP mode, so doesn't need another EXIT_XIP
+    if (ac->cmd.bCmdId != PC_READ && ac->cmd.bCmdId != PC_WRITE && ac->cmd.bCmdId != PC_FLASH_ERASE) {
+        s->xip_state = XIP_UNKOWN;
+        s->definitely_exclusive = false;
+    }
+    return 0;
+}
 
 enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_device_handle **dev_handle, chip_t *chip, int vid, int pid, const char* ser) {
     struct libusb_device_descriptor desc;
     struct libusb_config_descriptor *config;
 
-    definitely_exclusive = false;
     *dev_handle = NULL;
     *chip = unknown;
     int ret = libusb_get_device_descriptor(device, &desc);
@@ -111,11 +327,15 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
         }
     }
 
+    struct picoboot_device_state *s = &unknown_device_state;
     if (!ret) {
         ret  = libusb_open(device, dev_handle);
         if (ret && verbose) {
             output("Failed to open device %s\n", libusb_error_name(ret));
         }
+        if (!ret) {
+            s = add_device_state(*dev_handle);
+        }
         if (ret) {
             if (vid == 0 || strlen(ser) != 0) {
                 // didn't check vid or ser, so treat as unknown
@@ -156,18 +376,18 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
 
     if (!ret) {
         if (config->bNumInterfaces == 1) {
-            interface = 0;
+            s->interface = 0;
         } else {
-            interface = 1;
+            s->interface = 1;
         }
-        if (config->interface[interface].altsetting[0].bInterfaceClass == 0xff &&
-            config->interface[interface].altsetting[0].bNumEndpoints == 2) {
-            out_ep = config->interface[interface].altsetting[0].endpoint[0].bEndpointAddress;
-            in_ep = config->interface[interface].altsetting[0].endpoint[1].bEndpointAddress;
+        if (config->interface[s->interface].altsetting[0].bInterfaceClass == 0xff &&
+            config->interface[s->interface].altsetting[0].bNumEndpoints == 2) {
+            s->out_ep = config->interface[s->interface].altsetting[0].endpoint[0].bEndpointAddress;
+            s->in_ep = config->interface[s->interface].altsetting[0].endpoint[1].bEndpointAddress;
         }
-        if (out_ep && in_ep && !(out_ep & 0x80u) && (in_ep & 0x80u)) {
+        if (s->out_ep && s->in_ep && !(s->out_ep & 0x80u) && (s->in_ep & 0x80u)) {
             if (verbose) output("Found PICOBOOT interface\n");
-            ret = libusb_claim_interface(*dev_handle, interface);
+            ret = libusb_claim_interface(*dev_handle, s->interface);
             if (ret) {
                 if (verbose) output("Failed to claim interface %s\n", libusb_error_name(ret));
                 return dr_vidpid_bootrom_no_interface;
@@ -223,13 +443,18 @@ enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_d
     assert(ret);
 
     if (*dev_handle) {
-        libusb_close(*dev_handle);
+        picoboot_close_device(*dev_handle);
         *dev_handle = NULL;
     }
 
     return dr_error;
 }
 
+void picoboot_close_device(libusb_device_handle *dev_handle) {
+    remove_device_state(dev_handle);
+    libusb_close(dev_handle);
+}
+
 static bool is_halted(libusb_device_handle *usb_device, int ep) {
     uint8_t data[2];
 
@@ -253,21 +478,23 @@ static bool is_halted(libusb_device_handle *usb_device, int ep) {
 }
 
 int picoboot_reset(libusb_device_handle *usb_device) {
+    struct picoboot_device_state *s = get_device_state(usb_device);
     if (verbose) output("RESET\n");
-    if (is_halted(usb_device, in_ep))
-        libusb_clear_halt(usb_device, in_ep);
-    if (is_halted(usb_device, out_ep))
-        libusb_clear_halt(usb_device, out_ep);
+    if (s->async_count) async_cancel_all(s);
+    if (is_halted(usb_device, s->in_ep))
+        libusb_clear_halt(usb_device, s->in_ep);
+    if (is_halted(usb_device, s->out_ep))
+        libusb_clear_halt(usb_device, s->out_ep);
     int ret =
             libusb_control_transfer(usb_device, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_INTERFACE,
-                                    PICOBOOT_IF_RESET, 0, interface, NULL, 0, 1000);
+                                    PICOBOOT_IF_RESET, 0, s->interface, NULL, 0, 1000);
 
     if (ret != 0) {
         output("  ...failed\n");
         return ret;
     }
     if (verbose) output("  ...ok\n");
-    definitely_exclusive = false;
+    s->definitely_exclusive = false;
     return 0;
 }
 
@@ -279,7 +506,7 @@ int picoboot_cmd_status_verbose(libusb_device_handle *usb_device, struct picoboo
     int ret =
             libusb_control_transfer(usb_device,
                                     LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_INTERFACE | LIBUSB_ENDPOINT_IN,
-                                    PICOBOOT_IF_CMD_STATUS, 0, interface, (uint8_t *) status, sizeof(*status), 1000);
+                                    PICOBOOT_IF_CMD_STATUS, 0, get_device_state(usb_device)->interface, (uint8_t *) status, sizeof(*status), 1000);
 
     if (ret != sizeof(*status)) {
         output("  ...failed\n");
@@ -295,37 +522,39 @@ int picoboot_cmd_status(libusb_device_handle *usb_device, struct picoboot_cmd_st
     return picoboot_cmd_status_verbose(usb_device, status, verbose);
 }
 
-int one_time_bulk_timeout;
-
 int picoboot_cmd(libusb_device_handle *usb_device, struct picoboot_cmd *cmd, uint8_t *buffer, unsigned int buf_size) {
+    struct picoboot_device_state *s = get_device_state(usb_device);
     int sent = 0;
     int ret;
 
-    static int token = 1;
+    // any queued commands must complete first
+    ret = picoboot_async_flush(usb_device);
+    if (ret) return ret;
+
     cmd->dMagic = PICOBOOT_MAGIC;
-    cmd->dToken = token++;
-    ret = libusb_bulk_transfer(usb_device, out_ep, (uint8_t *) cmd, sizeof(struct picoboot_cmd), &sent, 3000);
+    cmd->dToken = s->token++;
+    ret = libusb_bulk_transfer(usb_device, s->out_ep, (uint8_t *) cmd, sizeof(struct picoboot_cmd), &sent, 3000);
 
     if (ret != 0 || sent != sizeof(struct picoboot_cmd)) {
         output("   ...failed to send command %s\n", libusb_error_name(ret));
         return ret;
     }
 
-    int saved_xip_state = xip_state;
-    bool saved_exclusive = definitely_exclusive;
-    xip_state = XIP_UNKOWN;
-    definitely_exclusive = false;
+    int saved_xip_state = s->xip_state;
+    bool saved_exclusive = s->definitely_exclusive;
+    s->xip_state = XIP_UNKOWN;
+    s->definitely_exclusive = false;
     int timeout = 10000;
-    if (one_time_bulk_timeout) {
-        timeout = one_time_bulk_timeout;
-        one_time_bulk_timeout = 0;
+    if (s->one_time_bulk_timeout) {
+        timeout = s->one_time_bulk_timeout;
+        s->one_time_bulk_timeout = 0;
     }
     if (cmd->dTransferLength != 0) {
         assert(buf_size >= cmd->dTransferLength);
         if (cmd->bCmdId & 0x80u) {
             if (verbose) output("  receive %d...\n", cmd->dTransferLength);
             int received = 0;
-            ret = libusb_bulk_transfer(usb_device, in_ep, buffer, cmd->dTransferLength, &received, timeout);
+            ret = libusb_bulk_transfer(usb_device, s->in_ep, buffer, cmd->dTransferLength, &received, timeout);
             if (ret != 0 || received != (int) cmd->dTransferLength) {
                 output("  ...failed to receive data %s %d/%d\n", libusb_error_name(ret), received, cmd->dTransferLength);
                 if (!ret) ret = 1;
@@ -333,7 +562,7 @@ int picoboot_cmd(libusb_device_handle *usb_device, struct picoboot_cmd *cmd, uin
             }
         } else {
             if (verbose) output("  send %d...\n", cmd->dTransferLength);
-            ret = libusb_bulk_transfer(usb_device, out_ep, buffer, cmd->dTransferLength, &sent, timeout);
+            ret = libusb_bulk_transfer(usb_device, s->out_ep, buffer, cmd->dTransferLength, &sent, timeout);
             if (ret != 0 || sent != (int) cmd->dTransferLength) {
                 output("  ...failed to send data %s %d/%d\n", libusb_error_name(ret), sent, cmd->dTransferLength);
                 if (!ret) ret = 1;
@@ -348,43 +577,43 @@ int picoboot_cmd(libusb_device_handle *usb_device, struct picoboot_cmd *cmd, uin
     uint8_t spoon[64];
     if (cmd->bCmdId & 0x80u) {
         if (verbose) output("zero length out\n");
-        ret = libusb_bulk_transfer(usb_device, out_ep, spoon, 1, &received, cmd->dTransferLength == 0 ? timeout : 3000);
+        ret = libusb_bulk_transfer(usb_device, s->out_ep, spoon, 1, &received, cmd->dTransferLength == 0 ? timeout : 3000);
     } else {
         if (verbose) output("zero length in\n");
-        ret = libusb_bulk_transfer(usb_device, in_ep, spoon, 1, &received, cmd->dTransferLength == 0 ? timeout : 3000);
+        ret = libusb_bulk_transfer(usb_device, s->in_ep, spoon, 1, &received, cmd->dTransferLength == 0 ? timeout : 3000);
     }
     if (!ret) {
         // do our defensive best to keep the xip_state up to date
         switch (cmd->bCmdId) {
             case PC_EXIT_XIP:
-                xip_state = XIP_INACTIVE;
+                s->xip_state = XIP_INACTIVE;
                 break;
             case PC_ENTER_CMD_XIP:
-                xip_state = XIP_ACTIVE;
+                s->xip_state = XIP_ACTIVE;
                 break;
             case PC_READ:
             case PC_WRITE:
                 // whitelist PC_READ and PC_WRITE as not affecting xip state
-                xip_state = saved_xip_state;
+                s->xip_state = saved_xip_state;
                 break;
             default:
-                xip_state = XIP_UNKOWN;
+                s->xip_state = XIP_UNKOWN;
                 break;
         }
         // do our defensive best to keep the exclusive var up to date
         switch (cmd->bCmdId) {
             case PC_EXCLUSIVE_ACCESS:
-                definitely_exclusive = cmd->exclusive_cmd.bExclusive;
+                s->definitely_exclusive = cmd->exclusive_cmd.bExclusive;
                 break;
             case PC_ENTER_CMD_XIP:
             case PC_EXIT_XIP:
             case PC_READ:
             case PC_WRITE:
                 // whitelist PC_READ and PC_WRITE as not affecting xip state
-                definitely_exclusive = saved_exclusive;
+                s->definitely_exclusive = saved_exclusive;
                 break;
             default:
-                definitely_exclusive = false;
+                s->definitely_exclusive = false;
                 break;
         }
     }
@@ -403,7 +632,8 @@ int picoboot_exclusive_access(libusb_device_handle *usb_device, uint8_t exclusiv
 }
 
 int picoboot_exit_xip(libusb_device_handle *usb_device) {
-    if (definitely_exclusive && xip_state == XIP_INACTIVE) {
+    struct picoboot_device_state *s = get_device_state(usb_device);
+    if (s->definitely_exclusive && s->xip_state == XIP_INACTIVE) {
         if (verbose) output("Skipping EXIT_XIP");
         return 0;
     }
@@ -412,7 +642,7 @@ int picoboot_exit_xip(libusb_device_handle *usb_device) {
     cmd.bCmdId = PC_EXIT_XIP;
     cmd.bCmdSize = 0;
     cmd.dTransferLength = 0;
-    xip_state = XIP_INACTIVE;
+    s->xip_state = XIP_INACTIVE;
     return picoboot_cmd(usb_device, &cmd, NULL, 0);
 }
 
@@ -422,7 +652,7 @@ int picoboot_enter_cmd_xip(libusb_device_handle *usb_device) {
     cmd.bCmdId = PC_ENTER_CMD_XIP;
     cmd.bCmdSize = 0;
     cmd.dTransferLength = 0;
-    xip_state = XIP_ACTIVE;
+    get_device_state(usb_device)->xip_state = XIP_ACTIVE;
     return picoboot_cmd(usb_device, &cmd, NULL, 0);
 }
 
@@ -468,6 +698,7 @@ int picoboot_flash_erase(libusb_device_handle *usb_device, uint32_t addr, uint32
     cmd.range_cmd.dAddr = addr;
     cmd.range_cmd.dSize = len;
     cmd.dTransferLength = 0;
+    get_device_state(usb_device)->one_time_bulk_timeout = flash_erase_timeout(len);
     return picoboot_cmd(usb_device, &cmd, NULL, 0);
 }
 
@@ -512,6 +743,55 @@ int picoboot_read(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buff
     return ret;
 }
 
+static int picoboot_cmd_queued(libusb_device_handle *usb_device, struct picoboot_cmd *cmd, uint8_t *buffer) {
+    if (!async_ctx || async_queue_depth < 2) {
+        return picoboot_cmd(usb_device, cmd, buffer, cmd->dTransferLength);
+    }
+    return picoboot_cmd_async(usb_device, cmd, buffer);
+}
+
+int picoboot_flash_erase_async(libusb_device_handle *usb_device, uint32_t addr, uint32_t len) {
+    struct picoboot_cmd cmd;
+    if (verbose) output("FLASH_ERASE (queued) %08x+%08x\n", (unsigned int) addr, (unsigned int) len);
+    cmd.bCmdId = PC_FLASH_ERASE;
+    cmd.bCmdSize = sizeof(cmd.range_cmd);
+    cmd.range_cmd.dAddr = addr;
+    cmd.range_cmd.dSize = len;
+    cmd.dTransferLength = 0;
+    return picoboot_cmd_queued(usb_device, &cmd, NULL);
+}
+
+int picoboot_write_async(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buffer, uint32_t len) {
+    struct picoboot_cmd cmd;
+    if (verbose) output("WRITE (queued) %08x+%08x\n", (unsigned int) addr, (unsigned int) len);
+    cmd.bCmdId = PC_WRITE;
+    cmd.bCmdSize = sizeof(cmd.range_cmd);
+    cmd.range_cmd.dAddr = addr;
+    cmd.range_cmd.dSize = cmd.dTransferLength = len;
+    return picoboot_cmd_queued(usb_device, &cmd, buffer);
+}
+
+int picoboot_exec_async(libusb_device_handle *usb_device, uint32_t addr) {
+    struct picoboot_cmd cmd;
+    if (verbose) output("EXEC (queued) %08x\n", (unsigned int) addr);
+    cmd.bCmdId = PC_EXEC;
+    cmd.bCmdSize = sizeof(cmd.address_only_cmd);
+    cmd.dTransferLength = 0;
+    cmd.address_only_cmd.dAddr = addr;
+    return picoboot_cmd_queued(usb_device, &cmd, NULL);
+}
+
+int picoboot_read_async(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buffer, uint32_t len) {
+    memset(buffer, 0xaa, len);
+    if (verbose) output("READ (queued) %08x+%08x\n", (unsigned int) addr, (unsigned int) len);
+    struct picoboot_cmd cmd;
+    cmd.bCmdId = PC_READ;
+    cmd.bCmdSize = sizeof(cmd.range_cmd);
+    cmd.range_cmd.dAddr = addr;
+    cmd.range_cmd.dSize = cmd.dTransferLength = len;
+    return picoboot_cmd_queued(usb_device, &cmd, buffer);
+}
+
 int picoboot_otp_write(libusb_device_handle *usb_device, struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len) {
     struct picoboot_cmd cmd;
     if (verbose) output("OTP WRITE %04x+%08x ecc=%d\n", (unsigned int) otp_cmd->wRow, otp_cmd->wRowCount, otp_cmd->bEcc);
@@ -523,7 +803,7 @@ int picoboot_otp_write(libusb_device_handle *usb_device, struct picoboot_otp_cmd
 #endif
     cmd.otp_cmd = *otp_cmd;
     cmd.dTransferLength = len;
-    one_time_bulk_timeout = 5000 + len * 5;
+    get_device_state(usb_device)->one_time_bulk_timeout = 5000 + len * 5;
     return picoboot_cmd(usb_device, &cmd, buffer, len);
 }
 
@@ -658,7 +938,13 @@ static const uint8_t picoboot_peek_cmd[] = {
 #define PEEK_POKE_CODE_LOC 0x20000000u
 
 #define FLASH_ID_CODE_LOC 0x15000000 // XIP_SRAM_BASE on RP2040, as we're not using XIP so probably fine
-#define FLASH_ID_UID_ADDR (FLASH_ID_CODE_LOC + 28 + 1 + 4)
+// the flash_id program sends the command in its txbuf, receiving the response into its rxbuf
+#define FLASH_ID_BUFLEN_OFFSET 8
+#define FLASH_ID_TXBUF_OFFSET 12
+#define FLASH_ID_RXBUF_OFFSET 28
+#define FLASH_RUID_CMD 0x4b
+#define FLASH_RUID_DUMMY_BYTES 4
+#define FLASH_RUID_DATA_BYTES 8
 
 int picoboot_poke(libusb_device_handle *usb_device, uint32_t addr, uint32_t data) {
     uint8_t prog[PICOBOOT_POKE_CMD_PROG_SIZE];
@@ -689,35 +975,43 @@ int picoboot_peek(libusb_device_handle *usb_device, uint32_t addr, uint32_t *dat
     return picoboot_read(usb_device, PEEK_POKE_CODE_LOC + picoboot_peek_cmd_len, (uint8_t *) data, sizeof(uint32_t));
 }
 
-int picoboot_flash_id(libusb_device_handle *usb_device, uint64_t *data) {
-    picoboot_exclusive_access(usb_device, 1);
+int picoboot_flash_cmd(libusb_device_handle *usb_device, const uint8_t *tx, uint8_t *rx, uint32_t len) {
     assert(PICOBOOT_FLASH_ID_CMD_PROG_SIZE == flash_id_bin_SIZE);
+    assert(len && len <= PICOBOOT_FLASH_CMD_MAX_LEN);
     uint8_t prog[PICOBOOT_FLASH_ID_CMD_PROG_SIZE];
-    uint64_t id;
-    output("GET FLASH ID\n");
+    output("FLASH CMD %02x + %d\n", tx[0], len - 1);
     memcpy(prog, flash_id_bin, flash_id_bin_SIZE);
+    *(uint32_t *) (prog + FLASH_ID_BUFLEN_OFFSET) = len;
+    memset(prog + FLASH_ID_TXBUF_OFFSET, 0, PICOBOOT_FLASH_CMD_MAX_LEN);
+    memcpy(prog + FLASH_ID_TXBUF_OFFSET, tx, len);
 
     // ensure XIP is exited before executing
     int ret = picoboot_exit_xip(usb_device);
-    if (ret) 
-        goto flash_id_return;
+    if (ret)
+        return ret;
     ret = picoboot_write(usb_device, FLASH_ID_CODE_LOC, prog, PICOBOOT_FLASH_ID_CMD_PROG_SIZE);
     if (ret)
-        goto flash_id_return;
+        return ret;
     ret = picoboot_exec(usb_device, FLASH_ID_CODE_LOC);
     if (ret)
-        goto flash_id_return;
-    ret = picoboot_read(usb_device, FLASH_ID_UID_ADDR, (uint8_t *) &id, sizeof(uint64_t));
-    *data = (((id & 0x00000000000000FF) << 56) |
-            ((id & 0x000000000000FF00) << 40) |
-            ((id & 0x0000000000FF0000) << 24) |
-            ((id & 0x00000000FF000000) <<  8) |
-            ((id & 0x000000FF00000000) >>  8) |
-            ((id & 0x0000FF0000000000) >> 24) |
-            ((id & 0x00FF000000000000) >> 40) |
-            ((id & 0xFF00000000000000) >> 56));
-
-flash_id_return:
+        return ret;
+    return picoboot_read(usb_device, FLASH_ID_CODE_LOC + FLASH_ID_RXBUF_OFFSET, rx, len);
+}
+
+int picoboot_flash_id(libusb_device_handle *usb_device, uint64_t *data) {
+    picoboot_exclusive_access(usb_device, 1);
+    uint8_t tx[1 + FLASH_RUID_DUMMY_BYTES + FLASH_RUID_DATA_BYTES] = {FLASH_RUID_CMD};
+    uint8_t rx[sizeof(tx)];
+    output("GET FLASH ID\n");
+    int ret = picoboot_flash_cmd(usb_device, tx, rx, sizeof(tx));
+    if (!ret) {
+        // the ID is sent most significant byte first
+        uint64_t id = 0;
+        for (int i = 0; i < FLASH_RUID_DATA_BYTES; i++) {
+            id = (id << 8) | rx[1 + FLASH_RUID_DUMMY_BYTES + i];
+        }
+        *data = id;
+    }
     picoboot_exclusive_access(usb_device, 0);
     return ret;
 }
@@ -44,6 +44,9 @@ enum picoboot_device_result {
 #if HAS_LIBUSB
 // note that vid and pid are filters, unless both are specified in which case a device with that VID and PID is allowed for RP2350
 enum picoboot_device_result picoboot_open_device(libusb_device *device, libusb_device_handle **dev_handle, chip_t *chip, int vid, int pid, const char* ser);
+// close a handle returned by picoboot_open_device; each open device has its own connection state, so several
+// devices may be used at once (from different threads), but devices must be opened and closed from a single thread
+void picoboot_close_device(libusb_device_handle *dev_handle);
 
 int picoboot_reset(libusb_device_handle *usb_device);
 int picoboot_cmd_status_verbose(libusb_device_handle *usb_device, struct picoboot_cmd_status *status,
@@ -65,6 +68,28 @@ int picoboot_otp_read(libusb_device_handle *usb_device, struct picoboot_otp_cmd
 int picoboot_poke(libusb_device_handle *usb_device, uint32_t addr, uint32_t data);
 int picoboot_peek(libusb_device_handle *usb_device, uint32_t addr, uint32_t *data);
 int picoboot_flash_id(libusb_device_handle *usb_device, uint64_t *data);
+// Send a command to the flash (RP2040 only), receiving len bytes back while the len bytes of tx are sent; tx includes
+// any address and dummy bytes, and zeros for the bytes to be received. This runs code from XIP SRAM, overwriting it.
+#define PICOBOOT_FLASH_CMD_MAX_LEN 16u
+int picoboot_flash_cmd(libusb_device_handle *usb_device, const uint8_t *tx, uint8_t *rx, uint32_t len);
+
+// Pipelined variants of the above: the command is queued (up to the queue depth), and only known to have completed
+// once picoboot_async_flush returns. The buffer must stay valid until then. Any synchronous command flushes the queue
+// first. Without picoboot_async_init (or with a queue depth of less than 2) these behave like the synchronous versions.
+#ifndef PICOBOOT_DEFAULT_QUEUE_DEPTH
+#define PICOBOOT_DEFAULT_QUEUE_DEPTH 8u
+#endif
+#define PICOBOOT_MAX_QUEUE_DEPTH 32u
+void picoboot_async_init(libusb_context *ctx, unsigned int queue_depth);
+unsigned int picoboot_async_queue_depth(void);
+int picoboot_flash_erase_async(libusb_device_handle *usb_device, uint32_t addr, uint32_t len);
+int picoboot_write_async(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buffer, uint32_t len);
+int picoboot_read_async(libusb_device_handle *usb_device, uint32_t addr, uint8_t *buffer, uint32_t len);
+// the program must return within the 10s the device is given to acknowledge a command
+int picoboot_exec_async(libusb_device_handle *usb_device, uint32_t addr);
+// wait until no more than max_pending queued commands are outstanding
+int picoboot_async_wait(libusb_device_handle *usb_device, unsigned int max_pending);
+int picoboot_async_flush(libusb_device_handle *usb_device);
 #endif
 
 // we require 256 (as this is the page size supported by the device)
@@ -74,6 +99,8 @@ int picoboot_flash_id(libusb_device_handle *usb_device, uint64_t *data);
 #endif
 #define PAGE_SIZE (1u << LOG2_PAGE_SIZE)
 #define FLASH_SECTOR_ERASE_SIZE 4096u
+// the bootrom uses block erases for any aligned 64K blocks within an erase range
+#define FLASH_BLOCK_ERASE_SIZE 65536u
 
 static inline bool is_size_aligned(uint32_t addr, int size) {
 #ifndef _MSC_VER
@@ -140,3 +140,32 @@ void connection::otp_read(struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uin
 void connection::flash_id(uint64_t &data) {
     wrap_call([&] { return picoboot_flash_id(device, &data); });
 }
+
+void connection::flash_cmd(const uint8_t *tx, uint8_t *rx, uint32_t len) {
+    wrap_call([&] { return picoboot_flash_cmd(device, tx, rx, len); });
+}
+
+void connection::flash_erase_async(uint32_t addr, uint32_t len) {
+    wrap_call([&] { return picoboot_flash_erase_async(device, addr, len); });
+}
+
+void connection::write_async(uint32_t addr, uint8_t *buffer, uint32_t len) {
+    wrap_call([&] { return picoboot_write_async(device, addr, buffer, len); });
+}
+
+void connection::read_async(uint32_t addr, uint8_t *buffer, uint32_t len) {
+    // Workaround due to picoboot interface not supporting reads over 4MiB
+    uint32_t max_chunk_size = 0x00400000;
+    for (uint32_t i=0; i < len; i += max_chunk_size) {
+        uint32_t read_size = std::min(len - i, max_chunk_size);
+        wrap_call([&] { return picoboot_read_async(device, addr + i, buffer + i, read_size); });
+    }
+}
+
+void connection::exec_async(uint32_t addr) {
+    wrap_call([&] { return picoboot_exec_async(device, addr); });
+}
+
+void connection::flush(unsigned int max_pending) {
+    wrap_call([&] { return picoboot_async_wait(device, max_pending); });
+}
@@ -58,12 +58,24 @@ namespace picoboot {
         void otp_write(struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len);
         void otp_read(struct picoboot_otp_cmd *otp_cmd, uint8_t *buffer, uint32_t len);
         void flash_id(uint64_t &data);
+        void flash_cmd(const uint8_t *tx, uint8_t *rx, uint32_t len);
+
+        // queued versions of flash_erase/write/read; the buffers must stay valid, and any errors
+        // are only reported, once flush() (or any other command) has been called
+        void flash_erase_async(uint32_t addr, uint32_t len);
+        void write_async(uint32_t addr, uint8_t *buffer, uint32_t len);
+        void read_async(uint32_t addr, uint8_t *buffer, uint32_t len);
+        void exec_async(uint32_t addr);
+        void flush(unsigned int max_pending = 0);
 
         std::vector<uint8_t> read_bytes(uint32_t addr, uint32_t len) {
             std::vector<uint8_t> bytes(len);
             read(addr, bytes.data(), len);
             return bytes;
         }
+
+        libusb_device_handle *get_device() const { return device; }
+        bool is_exclusive() const { return exclusive; }
     private:
         template <typename F> void wrap_call(F&& func);
         libusb_device_handle *device;